@@ -0,0 +1,1011 @@
+#ifndef __ADXL345_H__
+#define __ADXL345_H__
+
+// The ADXL345 (over the HPS I2C0 controller), shared by the accel kernel
+// module (accelmod/), the user level program of part 1, and the simulator
+// (sim/). Include address_map_arm.h first.
+
+/* Bit values in BW_RATE                                                */
+/* Expresed as output data rate */
+#define XL345_RATE_3200 0x0f
+#define XL345_RATE_1600 0x0e
+#define XL345_RATE_800 0x0d
+#define XL345_RATE_400 0x0c
+#define XL345_RATE_200 0x0b
+#define XL345_RATE_100 0x0a
+#define XL345_RATE_50 0x09
+#define XL345_RATE_25 0x08
+#define XL345_RATE_12_5 0x07
+#define XL345_RATE_6_25 0x06
+#define XL345_RATE_3_125 0x05
+#define XL345_RATE_1_563 0x04
+#define XL345_RATE__782 0x03
+#define XL345_RATE__39 0x02
+#define XL345_RATE__195 0x01
+#define XL345_RATE__098 0x00
+
+/* Sample period (in us) and output data rate (in mHz) of a BW_RATE code:
+   3200 Hz halves with every step down                                  */
+#define XL345_RATE_PERIOD_US(rate) ((625U << (XL345_RATE_3200 - (rate))) / 2)
+#define XL345_RATE_MILLIHZ(rate) (3200000U >> (XL345_RATE_3200 - (rate)))
+
+/* Bit values in DATA_FORMAT                                            */
+
+/* Register values read in DATAX0 through DATAZ1 are dependant on the
+   value specified in data format.  Customer code will need to interpret
+   the data as desired.                                                 */
+#define XL345_RANGE_2G 0x00
+#define XL345_RANGE_4G 0x01
+#define XL345_RANGE_8G 0x02
+#define XL345_RANGE_16G 0x03
+#define XL345_DATA_JUST_RIGHT 0x00
+#define XL345_DATA_JUST_LEFT 0x04
+#define XL345_10BIT 0x00
+#define XL345_FULL_RESOLUTION 0x08
+#define XL345_INT_LOW 0x20
+#define XL345_INT_HIGH 0x00
+#define XL345_SPI3WIRE 0x40
+#define XL345_SPI4WIRE 0x00
+#define XL345_SELFTEST 0x80
+
+/* Bit values in INT_ENABLE, INT_MAP, and INT_SOURCE are identical
+   use these bit values to read or write any of these registers.        */
+#define XL345_OVERRUN 0x01
+#define XL345_WATERMARK 0x02
+#define XL345_FREEFALL 0x04
+#define XL345_INACTIVITY 0x08
+#define XL345_ACTIVITY 0x10
+#define XL345_DOUBLETAP 0x20
+#define XL345_SINGLETAP 0x40
+#define XL345_DATAREADY 0x80
+
+/* Bit values in FIFO_CTL                                              */
+#define XL345_FIFO_MODE_BYPASS 0x00
+#define XL345_FIFO_MODE_FIFO 0x40
+#define XL345_FIFO_MODE_STREAM 0x80
+#define XL345_FIFO_MODE_TRIGGER 0xc0
+#define XL345_FIFO_SAMPLES_MASK 0x1f
+
+/* Bit values in FIFO_STATUS                                            */
+#define XL345_FIFO_ENTRIES_MASK 0x3f
+#define XL345_FIFO_TRIG 0x80
+
+/* Bit values in POWER_CTL                                              */
+#define XL345_WAKEUP_8HZ 0x00
+#define XL345_WAKEUP_4HZ 0x01
+#define XL345_WAKEUP_2HZ 0x02
+#define XL345_WAKEUP_1HZ 0x03
+#define XL345_SLEEP 0x04
+#define XL345_MEASURE 0x08
+#define XL345_STANDBY 0x00
+#define XL345_AUTO_SLEEP 0x10
+#define XL345_ACT_INACT_SERIAL 0x20
+#define XL345_ACT_INACT_CONCURRENT 0x00
+
+// ADXL345 Register List
+#define ADXL345_REG_DEVID 0x00
+
+// BEGIN TAP Registers (Required to implement tap capturing, i.e., single and
+// double taps)
+#define ADXL345_REG_THRESH_TAP 0x1D
+#define ADXL345_REG_DUR 0x21
+#define ADXL345_REG_LATENT 0x22
+#define ADXL345_REG_WINDOW 0x23
+#define ADXL345_REG_TAP_AXES 0x2A
+// END TAP registers
+
+#define ADXL345_REG_POWER_CTL 0x2D
+#define ADXL345_REG_DATA_FORMAT 0x31
+#define ADXL345_REG_FIFO_CTL 0x38
+#define ADXL345_REG_FIFO_STATUS 0x39 // read only
+#define ADXL345_REG_BW_RATE 0x2C
+#define ADXL345_REG_INT_ENABLE 0x2E // default value: 0x00
+#define ADXL345_REG_INT_MAP 0x2F    // default value: 0x00
+#define ADXL345_REG_INT_SOURCE 0x30 // default value: 0x02
+#define ADXL345_REG_DATAX0 0x32     // read only
+#define ADXL345_REG_DATAX1 0x33     // read only
+#define ADXL345_REG_DATAY0 0x34     // read only
+#define ADXL345_REG_DATAY1 0x35     // read only
+#define ADXL345_REG_DATAZ0 0x36     // read only
+#define ADXL345_REG_DATAZ1 0x37     // read only
+#define ADXL345_REG_OFSX 0x1E
+#define ADXL345_REG_OFSY 0x1F
+#define ADXL345_REG_OFSZ 0x20
+#define ADXL345_REG_THRESH_ACT 0x24
+#define ADXL345_REG_THRESH_INACT 0x25
+#define ADXL345_REG_TIME_INACT 0x26
+#define ADXL345_REG_ACT_INACT_CTL 0x27
+#define ADXL345_REG_THRESH_FF 0x28
+#define ADXL345_REG_TIME_FF 0x29
+
+// Rounded division macro
+#define ROUNDED_DIVISION(n, d)                                                 \
+  ((((n) < 0) ^ ((d) < 0)) ? (((n) - (d) / 2) / (d)) : (((n) + (d) / 2) / (d)))
+
+// Transports:
+// How the I2C0 registers are reached is chosen at compile time, and every
+// access below expands to it in place (no function pointers), so the
+// memory mapped transports cost no more than hand written MMIO:
+//  - kernel (__KERNEL__): the registers ioremap'ed at I2C0Virt by the accel
+//    module,
+//  - user space (the default): the registers mmap'ed from /dev/mem at
+//    I2C0Virt (see part1/fileio.h),
+//  - fake (ADXL345_SIM): the simulator in sim/ADXL345Sim.h, on any host.
+// Each also provides the clock, sleeps and warnings the I2C0 layer needs.
+#ifndef __KERNEL__
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define clamp(v, lo, hi) ((v) < (lo) ? (lo) : (v) > (hi) ? (hi) : (v))
+#endif
+
+#if defined(__KERNEL__)
+#define I2C0_READ(offset) (*(volatile unsigned int *)(I2C0Virt + (offset)))
+#define I2C0_WRITE(offset, value)                                              \
+  (*(volatile unsigned int *)(I2C0Virt + (offset)) = (value))
+#define ADXL345_NOW_NS() ktime_get_ns()
+#define ADXL345_SLEEP_US(Min, Max) usleep_range(Min, Max)
+#define ADXL345_RELAX() cpu_relax()
+#define ADXL345_WARN(...) printk(KERN_WARNING __VA_ARGS__)
+
+#elif defined(ADXL345_SIM)
+#include "sim/ADXL345Sim.h"
+#define I2C0_READ(offset) ADXL345Sim_Read(offset)
+#define I2C0_WRITE(offset, value) ADXL345Sim_Write(offset, value)
+#define ADXL345_NOW_NS() ADXL345Sim_Now()
+#define ADXL345_SLEEP_US(Min, Max) ADXL345Sim_Sleep((Min)*1000ULL)
+#define ADXL345_RELAX() ADXL345Sim_Relax()
+#define ADXL345_WARN(...) fprintf(stderr, __VA_ARGS__)
+
+#else
+static inline uint64_t ADXL345_MonotonicNs(void) {
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+static inline void ADXL345_SleepUs(unsigned int Us) {
+  struct timespec Delay = {Us / 1000000, (Us % 1000000) * 1000};
+  nanosleep(&Delay, NULL);
+}
+
+#define I2C0_READ(offset) (*(volatile unsigned int *)(I2C0Virt + (offset)))
+#define I2C0_WRITE(offset, value)                                              \
+  (*(volatile unsigned int *)(I2C0Virt + (offset)) = (value))
+#define ADXL345_NOW_NS() ADXL345_MonotonicNs()
+#define ADXL345_SLEEP_US(Min, Max) ADXL345_SleepUs(Min)
+#define ADXL345_RELAX() ((void)0)
+#define ADXL345_WARN(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+// These are set by whoever maps the registers (the accel kernel module, or
+// part 1).
+extern volatile unsigned int *SYSMGRVirt;
+extern volatile unsigned int *I2C0Virt;
+
+void Pinmux_Config(void) {
+  // Set up pin muxing (in sysmgr) to connect ADXL345 wires to I2C0
+  *(volatile unsigned int *)(SYSMGRVirt + SYSMGR_I2C0USEFPGA) = 0;
+  *(volatile unsigned int *)(SYSMGRVirt + SYSMGR_GENERALIO7) = 1;
+  *(volatile unsigned int *)(SYSMGRVirt + SYSMGR_GENERALIO8) = 1;
+}
+
+// I2C0 Transactions:
+// Every transfer is bounded in time. A transfer the ADXL345 doesn't
+// acknowledge fails with -EIO (the controller raises TX_ABRT), and a
+// controller which stops making progress (e.g., a stuck bus) fails with
+// -ETIMEDOUT after I2C0_TIMEOUT_US. Either way the controller is then
+// recovered (see I2C0_Recover), so the next transfer starts clean.
+//
+// At 400 kHz each byte on the wire takes 9 SCL periods (22.5 us), so a
+// transfer of N bytes can't complete in less than N * I2C0_BYTE_NS. Waits
+// sleep for that long, spin briefly for the last few bus cycles, then sleep
+// in byte sized steps if the transfer is running late.
+#define I2C0_BYTE_NS 22500
+#define I2C0_SPIN_NS 5000
+#define I2C0_TIMEOUT_US 5000
+#define I2C0_FIFO_DEPTH 64
+
+// Bit values in I2C0_DATA_CMD, I2C0_STATUS and I2C0_RAW_INTR_STAT
+#define I2C0_CMD_READ 0x100
+#define I2C0_CMD_RESTART 0x400
+#define I2C0_STATUS_TFE 0x04          // TX FIFO empty
+#define I2C0_STATUS_MST_ACTIVITY 0x20 // Master is busy
+#define I2C0_INTR_TX_ABRT 0x40
+
+// Wait conditions for I2C0_Wait: return 1 when met, 0 if not (yet), or a
+// negative error code if the transfer was aborted.
+static int I2C0_PollRx(unsigned int Count) {
+  if (I2C0_READ(I2C0_RAW_INTR_STAT) & I2C0_INTR_TX_ABRT)
+    return -EIO;
+  return I2C0_READ(I2C0_RXFLR) >= Count;
+}
+
+static int I2C0_PollTxDone(unsigned int Unused) {
+  unsigned int Status = I2C0_READ(I2C0_STATUS);
+  if (I2C0_READ(I2C0_RAW_INTR_STAT) & I2C0_INTR_TX_ABRT)
+    return -EIO;
+  return (Status & I2C0_STATUS_TFE) && !(Status & I2C0_STATUS_MST_ACTIVITY);
+}
+
+static int I2C0_PollEnabled(unsigned int Enabled) {
+  return (I2C0_READ(I2C0_ENABLE_STATUS) & 0x1) == Enabled;
+}
+
+// Wait until Poll(Arg) is met, for a transfer of Bytes bytes.
+// Returns 0, or a negative error code (-EIO, -ETIMEDOUT).
+static int I2C0_Wait(int (*Poll)(unsigned int), unsigned int Arg,
+                     unsigned int Bytes) {
+  unsigned int ExpectedUs = Bytes * I2C0_BYTE_NS / 1000;
+  uint64_t Deadline = ADXL345_NOW_NS() + I2C0_TIMEOUT_US * 1000ULL;
+  uint64_t SpinUntil;
+  uint64_t Now;
+  int Status;
+
+  // The transfer can't be done before it has gone out on the wire.
+  if (ExpectedUs)
+    ADXL345_SLEEP_US(ExpectedUs, ExpectedUs + ExpectedUs / 4);
+  SpinUntil = ADXL345_NOW_NS() + I2C0_SPIN_NS;
+
+  while (!(Status = Poll(Arg))) {
+    Now = ADXL345_NOW_NS();
+    if (Now > Deadline)
+      return -ETIMEDOUT;
+    if (Now < SpinUntil)
+      ADXL345_RELAX();
+    else
+      ADXL345_SLEEP_US(I2C0_BYTE_NS / 1000, 2 * I2C0_BYTE_NS / 1000);
+  }
+  return Status < 0 ? Status : 0;
+}
+
+// Initialize the I2C0 controller for use with the ADXL345 chip
+// Returns 0, or -ETIMEDOUT if the controller can't be disabled or enabled.
+int I2C0_Init(void) {
+  int Status;
+
+  // Abort any ongoing transmits and disable I2C0.
+  I2C0_WRITE(I2C0_ENABLE, 2);
+
+  // Wait until I2C0 is disabled
+  Status = I2C0_Wait(I2C0_PollEnabled, 0, 0);
+  if (Status)
+    return Status;
+
+  // Clear any abort left over from an earlier transfer.
+  (void)I2C0_READ(I2C0_CLR_TX_ABRT);
+
+  // Configure the config reg with the desired setting (act as
+  // a master, use 7bit addressing, fast mode (400kb/s)).
+  I2C0_WRITE(I2C0_CON, 0x65);
+
+  // Set target address (disable special commands, use 7bit addressing)
+  I2C0_WRITE(I2C0_TAR, 0x53);
+
+  // Set SCL high/low counts (Assuming default 100MHZ clock input to I2C0
+  // Controller). The minimum SCL high period is 0.6us, and the minimum SCL low
+  // period is 1.3us, However, the combined period must be 2.5us or greater, so
+  // add 0.3us to each.
+  I2C0_WRITE(I2C0_FS_SCL_HCNT, 60 + 30);  // 0.6us + 0.3us
+  I2C0_WRITE(I2C0_FS_SCL_LCNT, 130 + 30); // 1.3us + 0.3us
+
+  // Enable the controller
+  I2C0_WRITE(I2C0_ENABLE, 1);
+
+  // Wait until controller is enabled
+  return I2C0_Wait(I2C0_PollEnabled, 1, 0);
+}
+
+// Bring the controller back to a known state after a failed transfer:
+// clear the abort and any stale received bytes. If the controller stopped
+// making progress, it is disabled (aborting the transfer) and re-initialized.
+// Returns Error.
+static int I2C0_Recover(int Error) {
+  int i;
+
+  ADXL345_WARN("ADXL345: I2C0 transfer failed (%d, abort source %#x)\n",
+               Error, I2C0_READ(I2C0_TX_ABRT_SOURCE));
+  (void)I2C0_READ(I2C0_CLR_TX_ABRT);
+  for (i = 0; i < I2C0_FIFO_DEPTH && I2C0_READ(I2C0_RXFLR); i++)
+    (void)I2C0_READ(I2C0_DATA_CMD);
+  if (Error == -ETIMEDOUT)
+    I2C0_Init();
+  return Error;
+}
+
+// ADXL345_XFER_START(Read, Address, Bytes) is called before every transfer
+// (of Bytes on the wire, to/from the register at Address), and
+// ADXL345_XFER_DONE(Read, Address, Bytes, StartNs, Status) after it, with
+// the time it started. A driver may define them (before including this
+// file) to account for, or trace, the transfers.
+#ifndef ADXL345_XFER_START
+#define ADXL345_XFER_START(Read, Address, Bytes) ((void)0)
+#endif
+#ifndef ADXL345_XFER_DONE
+#define ADXL345_XFER_DONE(Read, Address, Bytes, StartNs, Status)              \
+  ((void)(StartNs))
+#endif
+
+// Register Shadow:
+// A copy of every writable register, kept up to date by every write (and
+// filled in by ADXL345_ReadRegs), so configuration can be read without I2C
+// traffic and redundant writes can be skipped. ADXL345_ShadowValid has a bit
+// set for each register whose shadowed value is known.
+#define ADXL345_REG_BIT(reg) (1ULL << (reg))
+#define ADXL345_REG_RANGE(lo, hi)                                              \
+  (((2ULL << (hi)) - 1) & ~(ADXL345_REG_BIT(lo) - 1))
+#define ADXL345_WRITABLE_REGS                                                  \
+  (ADXL345_REG_RANGE(0x1D, 0x2A) | ADXL345_REG_RANGE(0x2C, 0x2F) |             \
+   ADXL345_REG_BIT(0x31) | ADXL345_REG_BIT(0x38))
+// Registers which are only changed in standby (rate, format, tap and
+// activity detection).
+#define ADXL345_STANDBY_REGS                                                   \
+  (ADXL345_REG_BIT(0x1D) | ADXL345_REG_RANGE(0x21, 0x2A) |                     \
+   ADXL345_REG_BIT(0x2C) | ADXL345_REG_BIT(0x31))
+// At most this many registers with known values are rewritten to join two
+// bursts into one (a transaction costs two bytes more than its data).
+#define ADXL345_MAX_BRIDGE 2
+
+static uint8_t ADXL345_Shadow[64];
+static uint64_t ADXL345_ShadowValid;
+
+// Returns true if the register is known to hold value.
+static inline bool ADXL345_ShadowIs(uint8_t address, uint8_t value) {
+  return (ADXL345_ShadowValid & ADXL345_REG_BIT(address)) &&
+         ADXL345_Shadow[address] == value;
+}
+
+// Forget every shadowed value (e.g., when the device may have been reset).
+static inline void ADXL345_ShadowInvalidate(void) { ADXL345_ShadowValid = 0; }
+
+// Write len consecutive internal registers, starting at address, in one
+// transfer (len must be less than I2C0_FIFO_DEPTH).
+// Returns 0, or a negative error code.
+int ADXL345_REG_MULTI_WRITE(uint8_t address, const uint8_t values[],
+                            uint8_t len) {
+  uint64_t Start = ADXL345_NOW_NS();
+  int i;
+  int Status;
+
+  ADXL345_XFER_START(false, address, len + 2);
+  // Send reg address (+0x400 to send START signal)
+  I2C0_WRITE(I2C0_DATA_CMD, address + I2C0_CMD_RESTART);
+
+  // Send values (the ADXL345 increments the address after each)
+  for (i = 0; i < len; i++)
+    I2C0_WRITE(I2C0_DATA_CMD, values[i]);
+
+  // Wait until it is on the wire: slave address, reg address and values.
+  Status = I2C0_Wait(I2C0_PollTxDone, 0, len + 2);
+  ADXL345_XFER_DONE(false, address, len + 2, Start, Status);
+  for (i = 0; i < len; i++) {
+    if (!(ADXL345_WRITABLE_REGS & ADXL345_REG_BIT(address + i)))
+      continue;
+    // We don't know what a failed transfer left in the registers.
+    if (Status) {
+      ADXL345_ShadowValid &= ~ADXL345_REG_BIT(address + i);
+    } else {
+      ADXL345_Shadow[address + i] = values[i];
+      ADXL345_ShadowValid |= ADXL345_REG_BIT(address + i);
+    }
+  }
+  return Status ? I2C0_Recover(Status) : 0;
+}
+
+// Write value to internal register at address
+// Returns 0, or a negative error code.
+int ADXL345_REG_WRITE(uint8_t address, uint8_t value) {
+  return ADXL345_REG_MULTI_WRITE(address, &value, 1);
+}
+
+// Read multiple consecutive internal registers (len must not exceed
+// I2C0_FIFO_DEPTH). On failure, values is zeroed.
+// Returns 0, or a negative error code.
+int ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len) {
+  uint64_t Start = ADXL345_NOW_NS();
+  int i;
+  int Status;
+
+  ADXL345_XFER_START(true, address, len + 3);
+  // Send reg address (+0x400 to send START signal)
+  I2C0_WRITE(I2C0_DATA_CMD, address + I2C0_CMD_RESTART);
+
+  // Send read signal len times
+  for (i = 0; i < len; i++)
+    I2C0_WRITE(I2C0_DATA_CMD, I2C0_CMD_READ);
+
+  // Wait for all the bytes: slave address and reg address, then the
+  // (repeated) slave address and len bytes.
+  Status = I2C0_Wait(I2C0_PollRx, len, len + 3);
+  ADXL345_XFER_DONE(true, address, len + 3, Start, Status);
+  if (Status) {
+    memset(values, 0, len);
+    return I2C0_Recover(Status);
+  }
+
+  // Read the bytes
+  for (i = 0; i < len; i++)
+    values[i] = I2C0_READ(I2C0_DATA_CMD);
+  return 0;
+}
+
+// Read value from internal register at address
+// Returns 0, or a negative error code (value is then 0).
+int ADXL345_REG_READ(uint8_t address, uint8_t *value) {
+  return ADXL345_REG_MULTI_READ(address, value, 1);
+}
+
+// Read len consecutive writable registers, from the shadow if their values
+// are known, otherwise from the device (filling in the shadow).
+// Returns 0, or a negative error code.
+int ADXL345_ReadRegs(uint8_t address, uint8_t values[], uint8_t len) {
+  uint64_t Regs = ADXL345_REG_RANGE(address, address + len - 1);
+  int Status;
+  int i;
+
+  if ((ADXL345_ShadowValid & Regs) == Regs) {
+    memcpy(values, &ADXL345_Shadow[address], len);
+    return 0;
+  }
+  Status = ADXL345_REG_MULTI_READ(address, values, len);
+  if (Status)
+    return Status;
+  for (i = 0; i < len; i++) {
+    if (ADXL345_WRITABLE_REGS & ADXL345_REG_BIT(address + i)) {
+      ADXL345_Shadow[address + i] = values[i];
+      ADXL345_ShadowValid |= ADXL345_REG_BIT(address + i);
+    }
+  }
+  return 0;
+}
+
+// Returns true if the registers [From, To) can be rewritten with their
+// shadowed values to join two bursts.
+static bool ADXL345_CanBridge(uint8_t From, uint8_t To) {
+  for (; From < To; From++) {
+    if (From == ADXL345_REG_POWER_CTL ||
+        !(ADXL345_WRITABLE_REGS & ADXL345_ShadowValid &
+          ADXL345_REG_BIT(From)))
+      return false;
+  }
+  return true;
+}
+
+// Bring a list of {register, value} pairs (applied in order) up to date,
+// with as little I2C traffic as possible:
+//  - registers which already hold their value (per the shadow) are skipped,
+//  - runs of consecutive registers are written in a single burst,
+//  - if any register which must be changed in standby is written, the
+//    device is put in standby once for the whole update, then restored.
+// Order the list by register address for the fewest transfers.
+// Returns 0, or the error code of the first transfer which failed.
+int ADXL345_UpdateRegs(const uint8_t Regs[][2], int Count) {
+  uint8_t Burst[I2C0_FIFO_DEPTH - 1];
+  uint8_t First = 0;
+  uint8_t Reg;
+  uint8_t PowerCtl = XL345_STANDBY;
+  int Len = 0;
+  int Status = 0;
+  int RestoreStatus;
+  bool Standby = false;
+  int i;
+
+  for (i = 0; i < Count; i++) {
+    if ((ADXL345_STANDBY_REGS & ADXL345_REG_BIT(Regs[i][0])) &&
+        !ADXL345_ShadowIs(Regs[i][0], Regs[i][1]))
+      Standby = true;
+  }
+  if (Standby) {
+    Status = ADXL345_ReadRegs(ADXL345_REG_POWER_CTL, &PowerCtl, 1);
+    if (Status)
+      return Status;
+    // (Nothing to do if it's already in standby.)
+    Standby = PowerCtl & XL345_MEASURE;
+    if (Standby)
+      Status = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL,
+                                 PowerCtl & ~XL345_MEASURE);
+  }
+
+  for (i = 0; !Status && i < Count; i++) {
+    Reg = Regs[i][0];
+    // A register written again must wait for its earlier value to go out.
+    if (Len && Reg >= First && Reg < First + Len) {
+      Status = ADXL345_REG_MULTI_WRITE(First, Burst, Len);
+      Len = 0;
+      if (Status)
+        break;
+    }
+    if (ADXL345_ShadowIs(Reg, Regs[i][1]))
+      continue;
+    // Extend the pending burst if Reg follows it (closely enough).
+    if (Len && Reg >= First + Len &&
+        Reg - (First + Len) <= ADXL345_MAX_BRIDGE &&
+        Reg - First < sizeof(Burst) && ADXL345_CanBridge(First + Len, Reg)) {
+      for (; First + Len < Reg; Len++)
+        Burst[Len] = ADXL345_Shadow[First + Len];
+      Burst[Len++] = Regs[i][1];
+      continue;
+    }
+    if (Len) {
+      Status = ADXL345_REG_MULTI_WRITE(First, Burst, Len);
+      if (Status)
+        break;
+    }
+    First = Reg;
+    Burst[0] = Regs[i][1];
+    Len = 1;
+  }
+  if (!Status && Len)
+    Status = ADXL345_REG_MULTI_WRITE(First, Burst, Len);
+
+  if (Standby) {
+    RestoreStatus = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, PowerCtl);
+    if (!Status)
+      Status = RestoreStatus;
+  }
+  return Status;
+}
+
+// Event flags in INT_SOURCE (taps, activity, inactivity and free fall) are
+// cleared when INT_SOURCE is read. So that one read can't hide an event from
+// another, every read of INT_SOURCE latches them here, until they are
+// consumed with ADXL345_TakeEvents (or one of the Was* helpers).
+#define XL345_EVENTS                                                           \
+  (XL345_SINGLETAP | XL345_DOUBLETAP | XL345_ACTIVITY | XL345_INACTIVITY |     \
+   XL345_FREEFALL)
+static uint8_t ADXL345_LatchedEvents;
+
+// Latch the events of an INT_SOURCE value, and return it with every event
+// latched so far.
+static inline uint8_t ADXL345_LatchEvents(uint8_t IntSource) {
+  ADXL345_LatchedEvents |= IntSource & XL345_EVENTS;
+  return IntSource | ADXL345_LatchedEvents;
+}
+
+// Returns (and clears) the latched events in Mask.
+uint8_t ADXL345_TakeEvents(uint8_t Mask) {
+  uint8_t Events = ADXL345_LatchedEvents & Mask;
+  ADXL345_LatchedEvents &= ~Mask;
+  return Events;
+}
+
+// Read INT_SOURCE (latching its events). Returns its flags, along with any
+// unconsumed events latched by earlier reads.
+uint8_t ADXL345_WhichInterrupts(void) {
+  uint8_t data8;
+  ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &data8);
+  return ADXL345_LatchEvents(data8);
+}
+
+// Return true if there was activity since the last check (consumes the
+// ACTIVITY event).
+bool ADXL345_WasActivityUpdated(void) {
+  ADXL345_WhichInterrupts();
+  return ADXL345_TakeEvents(XL345_ACTIVITY) != 0;
+}
+
+// Return true if there is new data (checks DATA_READY bit).
+bool ADXL345_IsDataReady(void) {
+  return (ADXL345_WhichInterrupts() & XL345_DATAREADY) != 0;
+}
+
+// Return true if there was a single tap since the last check (consumes the
+// SINGLE_TAP event).
+bool ADXL345_WasSingleTapped(void) {
+  ADXL345_WhichInterrupts();
+  return ADXL345_TakeEvents(XL345_SINGLETAP) != 0;
+}
+
+// Return true if there was a double tap since the last check (consumes the
+// DOUBLE_TAP event).
+bool ADXL345_WasDoubleTapped(void) {
+  ADXL345_WhichInterrupts();
+  return ADXL345_TakeEvents(XL345_DOUBLETAP) != 0;
+}
+
+// Read acceleration data of all three axes
+// Returns 0, or a negative error code.
+int ADXL345_XYZ_Read(int16_t szData16[3]) {
+  uint8_t szData8[6];
+  int Status =
+      ADXL345_REG_MULTI_READ(0x32, (uint8_t *)&szData8, sizeof(szData8));
+
+  szData16[0] = (szData8[1] << 8) | szData8[0];
+  szData16[1] = (szData8[3] << 8) | szData8[2];
+  szData16[2] = (szData8[5] << 8) | szData8[4];
+  return Status;
+}
+
+// Get the number of samples waiting in the FIFO (0 - 32).
+// Returns 0, or a negative error code.
+int ADXL345_FifoEntries(uint8_t *Entries) {
+  int Status = ADXL345_REG_READ(ADXL345_REG_FIFO_STATUS, Entries);
+  *Entries &= XL345_FIFO_ENTRIES_MASK;
+  return Status;
+}
+
+// Read INT_SOURCE and the acceleration data of all three axes in a single
+// burst: INT_SOURCE (0x30), DATA_FORMAT (0x31) and DATAX0 - DATAZ1 (0x32 -
+// 0x37) are contiguous, so one START/address phase fetches all 8 bytes.
+// IntSource gets the INT_SOURCE flags (with any unconsumed events latched
+// earlier). szData16 only holds a new sample if XL345_DATAREADY is set.
+// Returns 0, or a negative error code.
+int ADXL345_StatusXYZ_Read(int16_t szData16[3], uint8_t *IntSource) {
+  uint8_t szData8[8];
+  int Status = ADXL345_REG_MULTI_READ(ADXL345_REG_INT_SOURCE,
+                                      (uint8_t *)&szData8, sizeof(szData8));
+
+  szData16[0] = (szData8[3] << 8) | szData8[2];
+  szData16[1] = (szData8[5] << 8) | szData8[4];
+  szData16[2] = (szData8[7] << 8) | szData8[6];
+  *IntSource = ADXL345_LatchEvents(szData8[0]);
+  return Status;
+}
+
+// The most samples ADXL345_DrainFifo returns: the one in the data registers,
+// and the 32 behind it in the FIFO.
+#define ADXL345_DRAIN_MAX 33
+
+// Read every new sample, oldest first, into XYZ (at most Max, at least 1).
+// INT_SOURCE and the first sample are fetched in one burst; in stream mode
+// (Stream) this pops the first FIFO entry, and FIFO_STATUS then tells how
+// many more are waiting, each fetched with its own DATAX0 - DATAZ1 burst.
+// IntSource gets the INT_SOURCE flags (as ADXL345_StatusXYZ_Read).
+// Returns the number of samples read (0 if DATA_READY wasn't set), or a
+// negative error code if INT_SOURCE couldn't be read. A later transfer which
+// fails ends the drain early, with its error code in *Error (0 otherwise):
+// the samples read before it are still returned.
+int ADXL345_DrainFifo(int16_t XYZ[][3], unsigned int Max, bool Stream,
+                      uint8_t *IntSource, int *Error) {
+  uint8_t Waiting = 0;
+  unsigned int Entries;
+  unsigned int i;
+  int Status;
+
+  *Error = 0;
+  Status = ADXL345_StatusXYZ_Read(XYZ[0], IntSource);
+  if (Status)
+    return Status;
+  if (!(*IntSource & XL345_DATAREADY))
+    return 0;
+  if (Stream && (*Error = ADXL345_FifoEntries(&Waiting)))
+    Waiting = 0;
+  Entries = 1 + Waiting;
+  if (Entries > Max)
+    Entries = Max;
+
+  for (i = 1; i < Entries; ++i) {
+    if ((Status = ADXL345_XYZ_Read(XYZ[i]))) {
+      *Error = Status;
+      break;
+    }
+  }
+  return i;
+}
+
+// Read the ID register
+int ADXL345_IdRead(uint8_t *pId) {
+  return ADXL345_REG_READ(ADXL345_REG_DEVID, pId);
+}
+
+// Write a BW_RATE code (XL345_RATE_*) to the device.
+// Returns 0, or a negative error code.
+int ADXL345_SetRate(uint8_t Rate) {
+  const uint8_t Regs[][2] = {{ADXL345_REG_BW_RATE, Rate}};
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Rate gets the BW_RATE code that was written to the device.
+// Returns 0, or a negative error code.
+int ADXL345_SetFreq(uint16_t Freq, uint8_t *Rate) {
+  // From the user provided sampling frequency,
+  // identifty the "known" requested frequency and write to reg.
+  //
+  // NOTE: (1) if the user requested freq doesn't exit, we default
+  //       to 12.5 hz.
+  //       (2) When requesting for non-whole number sampling freqs
+  //       (i.e., 12.5, 6.25, 3.125 1.563), the user must only specify
+  //       the integer value of these.
+  //       (3) We support the frequency range from 3200 hz t0 1.563 hz.
+  switch (Freq) {
+  case 3200:
+    *Rate = XL345_RATE_3200;
+    break;
+  case 1600:
+    *Rate = XL345_RATE_1600;
+    break;
+  case 800:
+    *Rate = XL345_RATE_800;
+    break;
+  case 400:
+    *Rate = XL345_RATE_400;
+    break;
+  case 200:
+    *Rate = XL345_RATE_200;
+    break;
+  case 100:
+    *Rate = XL345_RATE_100;
+    break;
+  case 50:
+    *Rate = XL345_RATE_50;
+    break;
+  case 25:
+    *Rate = XL345_RATE_25;
+    break;
+  case 12:
+    *Rate = XL345_RATE_12_5;
+    break;
+  case 6:
+    *Rate = XL345_RATE_6_25;
+    break;
+  case 3:
+    *Rate = XL345_RATE_3_125;
+    break;
+  case 1:
+    *Rate = XL345_RATE_1_563;
+    break;
+  default:
+    *Rate = XL345_RATE_12_5;
+  }
+  return ADXL345_SetRate(*Rate);
+}
+
+// Format gets the DATA_FORMAT value that was written to the device.
+// Returns 0, or a negative error code.
+int ADXL345_SetG(bool FullRes, uint16_t G, int16_t *Scale, uint8_t *Format) {
+  // Depending on the requested data format (e.g., Full Resolution @
+  // +/- 16G), the Scale factor should be updated appropriately.
+  // NOTES: if the request graviational resolution does not exist (or
+  //        we don't support it), we default to XL345_RANGE_16G at 10-bit res.
+  uint8_t GSet;
+  switch (G) {
+  case 2:
+    GSet = XL345_RANGE_2G;
+    *Scale = ROUNDED_DIVISION(2 * 1000, 512);
+    break;
+  case 4:
+    GSet = XL345_RANGE_4G;
+    *Scale = ROUNDED_DIVISION(4 * 1000, 512);
+    break;
+  case 8:
+    GSet = XL345_RANGE_8G;
+    *Scale = ROUNDED_DIVISION(8 * 1000, 512);
+    break;
+  case 16:
+    GSet = XL345_RANGE_16G;
+    *Scale = ROUNDED_DIVISION(16 * 1000, 512);
+    break;
+  default:
+    GSet = XL345_RANGE_16G;
+    *Scale = ROUNDED_DIVISION(16 * 1000, 512);
+  }
+  if (FullRes) {
+    GSet |= XL345_FULL_RESOLUTION;
+    *Scale = 4;
+  }
+  *Format = GSet;
+  {
+    const uint8_t Regs[][2] = {{ADXL345_REG_DATA_FORMAT, GSet}};
+    return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+  }
+}
+
+// Configure the FIFO: Mode is one of XL345_FIFO_MODE_*, and Watermark
+// the number of samples (1 - 31) at which the WATERMARK interrupt is set.
+// Returns 0, or a negative error code.
+int ADXL345_SetFifo(uint8_t Mode, uint8_t Watermark) {
+  const uint8_t Regs[][2] = {
+      {ADXL345_REG_FIFO_CTL, Mode | (Watermark & XL345_FIFO_SAMPLES_MASK)}};
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Enable interrupts (XL345_* bits), and route them to the INT1 (bit clear)
+// or INT2 (bit set) pin.
+// Returns 0, or a negative error code.
+int ADXL345_SetInterrupts(uint8_t Enable, uint8_t Map) {
+  // Interrupts are disabled while they are re-routed.
+  const uint8_t Remap[][2] = {{ADXL345_REG_INT_ENABLE, 0},
+                              {ADXL345_REG_INT_MAP, Map},
+                              {ADXL345_REG_INT_ENABLE, Enable}};
+  const uint8_t Regs[][2] = {{ADXL345_REG_INT_ENABLE, Enable}};
+
+  if (!ADXL345_ShadowIs(ADXL345_REG_INT_MAP, Map))
+    return ADXL345_UpdateRegs(Remap, ARRAY_SIZE(Remap));
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Configure tap detection (see ADXL345_Init for the units of each register).
+// Returns 0, or a negative error code.
+int ADXL345_SetTap(uint8_t Thresh, uint8_t Dur, uint8_t Latent,
+                   uint8_t Window, uint8_t Axes) {
+  const uint8_t Regs[][2] = {{ADXL345_REG_THRESH_TAP, Thresh},
+                             {ADXL345_REG_DUR, Dur},
+                             {ADXL345_REG_LATENT, Latent},
+                             {ADXL345_REG_WINDOW, Window},
+                             {ADXL345_REG_TAP_AXES, Axes}};
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Configure activity/inactivity detection.
+// Returns 0, or a negative error code.
+int ADXL345_SetActivity(uint8_t ThreshAct, uint8_t ThreshInact,
+                        uint8_t TimeInact, uint8_t ActInactCtl) {
+  const uint8_t Regs[][2] = {{ADXL345_REG_THRESH_ACT, ThreshAct},
+                             {ADXL345_REG_THRESH_INACT, ThreshInact},
+                             {ADXL345_REG_TIME_INACT, TimeInact},
+                             {ADXL345_REG_ACT_INACT_CTL, ActInactCtl}};
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Initialize the ADXL345 chip
+// Every register is written (the shadow is discarded first), in register
+// order so that consecutive registers go out in as few bursts as possible.
+// Returns 0, or a negative error code.
+int ADXL345_Init(void) {
+  const uint8_t Regs[][2] = {
+      // NOTE: Since the DATA_READY bit will be toggled at a high rate,
+      // it's possible to only indicate if there was some activity via a
+      // threshold. the tutorial provided demonstrated this using ACTIVITY
+      // THRESHOLD interrupts. they've been left here (as it's possible to use
+      // this functionality, rather than polling the DATA_READY bit).
+      //----- Enabling interrupts -----//
+
+      // Tap Threshold = 3G
+      // 3000mg/62.5mg/LSB == 48 (base 10)
+      {ADXL345_REG_THRESH_TAP, 48},
+
+      // Tap Duration = 0.02s
+      // 20000 us / 625 us/LSB == 32 (base 10)
+      {ADXL345_REG_DUR, 32},
+
+      // Tap Latency = 0.02s
+      // 20 ms / 1.25ms/LSB == 16 (base 10)
+      {ADXL345_REG_LATENT, 16},
+
+      // Double Tap Window = 0.3s
+      // 300/ 1.25ms/LSB == 240 (base 10)
+      {ADXL345_REG_WINDOW, 240},
+
+      {ADXL345_REG_THRESH_ACT, 0x04},    // activity threshold
+      {ADXL345_REG_THRESH_INACT, 0x02},  // inactivity threshold
+      {ADXL345_REG_TIME_INACT, 0x02},    // time for inactivity
+      {ADXL345_REG_ACT_INACT_CTL, 0xFF}, // Enables AC coupling for thresholds
+
+      // Free fall detection isn't used: these are written (with their reset
+      // values) so that 0x21 - 0x2A go out in a single burst.
+      {ADXL345_REG_THRESH_FF, 0x00},
+      {ADXL345_REG_TIME_FF, 0x00},
+
+      // Allow for Taps to be detected on the Z axis.
+      {ADXL345_REG_TAP_AXES, 0x01},
+
+      // Output Data Rate: 12.5Hz
+      {ADXL345_REG_BW_RATE, XL345_RATE_12_5},
+
+      // Route every interrupt to the INT1 pin.
+      {ADXL345_REG_INT_ENABLE, XL345_SINGLETAP | XL345_DOUBLETAP |
+                                   XL345_ACTIVITY |
+                                   XL345_INACTIVITY}, // enable interrupts
+      {ADXL345_REG_INT_MAP, 0x00},
+      //-------------------------------//
+
+      // 16g range, Fixed resolution (10-bits).
+      {ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G},
+
+      // FIFO bypassed: one sample at a time.
+      {ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS}};
+  int Status;
+
+  ADXL345_ShadowInvalidate();
+
+  // Stop Measuring.
+  Status = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY);
+  if (!Status)
+    Status = ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+  if (Status)
+    return Status;
+
+  // start measure
+  return ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE);
+}
+
+// Write the offset registers (15.6 mg/LSB, added to every sample). These
+// don't need a standby cycle, and are left alone by ADXL345_Init.
+// Returns 0, or a negative error code.
+int ADXL345_SetOffsets(const int8_t Offsets[3]) {
+  const uint8_t Regs[][2] = {{ADXL345_REG_OFSX, Offsets[0]},
+                             {ADXL345_REG_OFSY, Offsets[1]},
+                             {ADXL345_REG_OFSZ, Offsets[2]}};
+
+  return ADXL345_UpdateRegs(Regs, ARRAY_SIZE(Regs));
+}
+
+// Read the offset registers (from the shadow when known).
+// Returns 0, or a negative error code.
+int ADXL345_GetOffsets(int8_t Offsets[3]) {
+  return ADXL345_ReadRegs(ADXL345_REG_OFSX, (uint8_t *)Offsets, 3);
+}
+
+// Cancel out a measured error (in mg, for each axis) by adjusting the
+// offset registers.
+// Returns 0, or a negative error code.
+int ADXL345_CorrectOffsets(const int ErrorMG[3]) {
+  int8_t Offsets[3];
+  int Status;
+  int i;
+
+  Status = ADXL345_GetOffsets(Offsets);
+  if (Status)
+    return Status;
+  for (i = 0; i < 3; i++)
+    Offsets[i] = clamp(Offsets[i] - ROUNDED_DIVISION(ErrorMG[i] * 10, 156),
+                       -128, 127);
+  return ADXL345_SetOffsets(Offsets);
+}
+
+#ifndef __KERNEL__
+// Calibrate the ADXL345 (blocking, for the user level programs: the kernel
+// module calibrates in the background, from the samples it streams). The
+// DE1-SoC should be placed on a flat surface, and must remain stationary for
+// the duration of the calibration (32 samples at 100 Hz). The rate and data
+// format are restored afterwards.
+// Returns 0, or a negative error code (-ETIMEDOUT if no samples arrive).
+int ADXL345_Calibrate(void) {
+  const uint8_t Calibrate[][2] = {
+      {ADXL345_REG_BW_RATE, XL345_RATE_100},
+      {ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION}};
+  uint8_t Restore[][2] = {{ADXL345_REG_BW_RATE, 0},
+                          {ADXL345_REG_DATA_FORMAT, 0}};
+  uint64_t Deadline = ADXL345_NOW_NS() + 2000000000ULL;
+  int Sum[3] = {0, 0, 0};
+  int ErrorMG[3];
+  int16_t XYZ[3];
+  uint8_t IntSource;
+  int RestoreStatus;
+  int Status;
+  int i = 0;
+
+  Status = ADXL345_ReadRegs(ADXL345_REG_BW_RATE, &Restore[0][1], 1);
+  if (!Status)
+    Status = ADXL345_ReadRegs(ADXL345_REG_DATA_FORMAT, &Restore[1][1], 1);
+  if (!Status)
+    Status = ADXL345_UpdateRegs(Calibrate, ARRAY_SIZE(Calibrate));
+  if (Status)
+    return Status;
+
+  // Average 32 samples (3.9 mg/LSB). Note: use DATA_READY here, can't use
+  // ACTIVITY because board is stationary.
+  while (!Status && i < 32) {
+    Status = ADXL345_StatusXYZ_Read(XYZ, &IntSource);
+    if (!Status && (IntSource & XL345_DATAREADY)) {
+      Sum[0] += XYZ[0];
+      Sum[1] += XYZ[1];
+      Sum[2] += XYZ[2];
+      i++;
+    } else if (!Status && ADXL345_NOW_NS() > Deadline) {
+      Status = -ETIMEDOUT;
+    } else if (!Status) {
+      ADXL345_SLEEP_US(1000, 2000);
+    }
+  }
+
+  // At rest only Z should see gravity (+1 g, 256 LSB).
+  if (!Status) {
+    ErrorMG[0] = ROUNDED_DIVISION(Sum[0] * 1000, 32 * 256);
+    ErrorMG[1] = ROUNDED_DIVISION(Sum[1] * 1000, 32 * 256);
+    ErrorMG[2] = ROUNDED_DIVISION((Sum[2] - 32 * 256) * 1000, 32 * 256);
+    Status = ADXL345_CorrectOffsets(ErrorMG);
+  }
+  // Restore the rate and format even if calibration failed.
+  RestoreStatus =
+      ADXL345_UpdateRegs((const uint8_t(*)[2])Restore, ARRAY_SIZE(Restore));
+  return Status ? Status : RestoreStatus;
+}
+#endif
+
+#endif /*ACCELEROMETER_ADXL345_SPI_H_*/
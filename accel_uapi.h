@@ -0,0 +1,190 @@
+#ifndef __ACCEL_UAPI_H__
+#define __ACCEL_UAPI_H__
+
+// Definitions shared between the accel kernel module (accelmod/accel.c)
+// and the user level programs which read from /dev/accel.
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+// Read modes for /dev/accel (selected with the "mode" command):
+//  text:   "RR XXXX YYYY ZZZZ SS NNNN TTTT\n" (the default, so `cat /dev/accel`
+//          works): status (hex), X, Y, Z, scale, then the sequence number and
+//          timestamp (ns) of struct AccelSample.
+//  binary: one struct AccelSample per sample, no formatting or parsing.
+#define ACCEL_MODE_TEXT 0
+#define ACCEL_MODE_BINARY 1
+
+// What the driver does when its sample ring is full
+// (selected with the "overflow" command):
+//  overwrite: the oldest unread sample is replaced (the default).
+//  drop:      the newest sample is discarded.
+#define ACCEL_OVERFLOW_OVERWRITE 0
+#define ACCEL_OVERFLOW_DROP 1
+
+// How the driver uses the ADXL345's 32 sample FIFO
+// (selected with the "fifo" command, or ACCEL_IOC_SET_FIFO):
+//  bypass: one sample is fetched per data ready (the default).
+//  stream: the FIFO keeps the most recent samples, and the driver drains all
+//          of them at once whenever the watermark (1 - 31 samples) is reached.
+#define ACCEL_FIFO_BYPASS 0
+#define ACCEL_FIFO_STREAM 1
+
+// A single accelerometer sample, as returned by /dev/accel in binary mode.
+// The layout is fixed (packed, little endian) so it can be copied directly
+// to user space.
+struct AccelSample {
+  uint64_t Timestamp; // CLOCK_MONOTONIC time of acquisition (ns)
+  uint32_t Seq;       // Incremented for every new (DATA_READY) sample
+  int16_t X;          // Raw X (LSB)
+  int16_t Y;          // Raw Y (LSB)
+  int16_t Z;          // Raw Z (LSB)
+  int16_t Scale;      // Scale factor (mg per LSB)
+  uint8_t Status;     // INT_SOURCE flags (same bits as XL345_*)
+  uint8_t Reserved[3];
+} __attribute__((packed));
+
+// Events (INT_SOURCE flags which the ADXL345 clears when they are read):
+// single tap, double tap, activity, inactivity, free fall and FIFO overrun.
+// The driver queues every event it sees, and each open file receives each
+// event exactly once: with ACCEL_IOC_READ_EVENTS, or (in text mode) in the
+// SS flags of its next read.
+#define ACCEL_EVENTS 0x7F // XL345_SINGLETAP | ... | XL345_OVERRUN
+
+// Reported when a calibration (see ACCEL_IOC_CALIBRATE) completes. It is
+// outside ACCEL_EVENTS (DATA_READY is never an event), so it never shows up
+// in a sample's status: only ACCEL_IOC_READ_EVENTS reports it.
+#define ACCEL_EVENT_CALIBRATED 0x80
+
+struct AccelEvent {
+  uint64_t Timestamp; // CLOCK_MONOTONIC time the event was seen (ns)
+  uint32_t Seq;       // Seq of the most recent sample at that time
+  uint8_t Type;       // A single ACCEL_EVENTS flag, or ACCEL_EVENT_CALIBRATED
+  uint8_t Reserved;
+  int16_t Error; // ACCEL_EVENT_CALIBRATED: 0, or why it failed (-errno)
+} __attribute__((packed));
+
+// The sample ring can be mapped (read only) into user space with
+// mmap(NULL, ACCEL_RING_MAP_SIZE(Size), PROT_READ, MAP_SHARED, fd, 0).
+// The mapping starts with a struct AccelRingHeader, followed by Size
+// struct AccelSample slots at ACCEL_RING_DATA_OFFSET.
+//
+// Head and Tail are free running counters (the slot of sample N is
+// N & (Size - 1)). The driver writes the sample at Head, then increments
+// Head; samples [Tail, Head) are valid. One slot is always kept free for
+// the driver to write into, so at most Size - 1 samples are valid.
+//
+// A consumer keeps its own position, copies the samples it wants, then
+// re-reads Head. As Head is only published once its slot is written, the
+// slot being written is that of sample Head - Size: a copied sample N is
+// valid while (Head - N) < Size, and must be discarded otherwise (it may
+// have been overwritten while it was being copied). ReadRingFrom in
+// driverutils.h follows this rule.
+struct AccelRingHeader {
+  uint32_t Head;      // Number of samples written so far
+  uint32_t Tail;      // Oldest sample still in the ring
+  uint32_t Size;      // Number of slots (a power of two)
+  uint32_t Seq;       // Sequence number of the most recent sample
+  uint32_t Overflows; // Samples lost because the ring was full
+  uint32_t Reserved[11];
+};
+
+#define ACCEL_RING_DATA_OFFSET 64
+#define ACCEL_RING_MAP_SIZE(Size)                                              \
+  (ACCEL_RING_DATA_OFFSET + (Size) * sizeof(struct AccelSample))
+
+// ioctl Interface:
+// Typed alternatives to the text commands. Every "set" request validates its
+// argument (failing with EINVAL), applies it, and writes the effective value
+// back into the argument.
+#define ACCEL_IOC_MAGIC 0xAD
+
+// Output data rate in mHz (e.g., 12500 for 12.5 Hz). The highest supported
+// rate (3200 Hz, 1600 Hz, ..., 0.098 Hz) not above the request is used.
+#define ACCEL_IOC_SET_RATE _IOWR(ACCEL_IOC_MAGIC, 1, uint32_t)
+
+struct AccelFormat {
+  uint8_t Range;   // +/- 2, 4, 8 or 16 g
+  uint8_t FullRes; // 0: fixed 10-bit resolution, 1: full resolution
+  int16_t Scale;   // (effective) mg per LSB
+};
+#define ACCEL_IOC_SET_FORMAT _IOWR(ACCEL_IOC_MAGIC, 2, struct AccelFormat)
+
+// Re-calibrate the offsets (the board must be flat and stationary), from the
+// number of samples given as the argument (0 for the default, 32).
+// Calibration runs in the background, while sampling continues: an
+// ACCEL_EVENT_CALIBRATED event reports its completion. A request made while
+// a calibration is running (e.g., the one started when the driver is loaded)
+// joins it, and is completed by the same event.
+#define ACCEL_CALIBRATE_DEFAULT 32
+#define ACCEL_CALIBRATE_MIN 8
+#define ACCEL_CALIBRATE_MAX 1024
+#define ACCEL_IOC_CALIBRATE _IO(ACCEL_IOC_MAGIC, 3)
+
+#define ACCEL_IOC_GET_DEVID _IOR(ACCEL_IOC_MAGIC, 4, uint32_t)
+
+// Tap and activity detection, in ADXL345 register units.
+struct AccelThresholds {
+  uint8_t ThreshTap;   // 62.5 mg/LSB (must not be 0)
+  uint8_t Dur;         // 625 us/LSB
+  uint8_t Latent;      // 1.25 ms/LSB
+  uint8_t Window;      // 1.25 ms/LSB
+  uint8_t TapAxes;     // XL345 TAP_AXES bits (0x00 - 0x0F)
+  uint8_t ThreshAct;   // 62.5 mg/LSB (must not be 0)
+  uint8_t ThreshInact; // 62.5 mg/LSB (must not be 0)
+  uint8_t TimeInact;   // 1 s/LSB
+  uint8_t ActInactCtl; // XL345 ACT_INACT_CTL bits
+  uint8_t Reserved[3];
+};
+#define ACCEL_IOC_SET_THRESHOLDS                                               \
+  _IOWR(ACCEL_IOC_MAGIC, 5, struct AccelThresholds)
+
+struct AccelFifo {
+  uint8_t Mode;      // ACCEL_FIFO_*
+  uint8_t Watermark; // Samples (1 - 31), used in stream mode
+};
+#define ACCEL_IOC_SET_FIFO _IOWR(ACCEL_IOC_MAGIC, 7, struct AccelFifo)
+
+// Take up to Max of this file's unread events (oldest first).
+// Lost counts the events this file missed because it fell too far behind.
+struct AccelEventRead {
+  uint64_t Events; // (struct AccelEvent *) buffer for Max events
+  uint32_t Max;
+  uint32_t Count; // Number of events copied
+  uint32_t Lost;
+  uint32_t Reserved;
+};
+#define ACCEL_IOC_READ_EVENTS _IOWR(ACCEL_IOC_MAGIC, 8, struct AccelEventRead)
+
+// The offset registers (15.6 mg/LSB), so a calibration can be saved and
+// restored instead of repeated (e.g., after the board is power cycled).
+// DevId identifies the device the offsets were taken from: setting offsets
+// fails with ENODEV if it doesn't match. Calibrated is set when the current
+// offsets came from a calibration or were restored (it is ignored when
+// setting them).
+struct AccelOffsets {
+  uint32_t DevId;
+  int8_t X;
+  int8_t Y;
+  int8_t Z;
+  uint8_t Calibrated;
+};
+#define ACCEL_IOC_GET_OFFSETS _IOR(ACCEL_IOC_MAGIC, 9, struct AccelOffsets)
+#define ACCEL_IOC_SET_OFFSETS _IOW(ACCEL_IOC_MAGIC, 10, struct AccelOffsets)
+
+struct AccelConfig {
+  uint32_t RateMilliHz;
+  struct AccelFormat Format;
+  uint8_t Mode;           // ACCEL_MODE_* of the file
+  uint8_t OverflowPolicy; // ACCEL_OVERFLOW_*
+  struct AccelFifo Fifo;
+  struct AccelThresholds Thresholds;
+};
+#define ACCEL_IOC_GET_CONFIG _IOR(ACCEL_IOC_MAGIC, 6, struct AccelConfig)
+
+#endif
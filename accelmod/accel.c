@@ -1,15 +1,43 @@
 #include <asm/io.h>          // for mmap
+#include <linux/debugfs.h>   // for the statistics
+#include <linux/delay.h>     // for usleep_range
 #include <linux/fs.h>        // struct file, struct file_operations
+#include <linux/gpio.h>      // for the ADXL345 interrupt line
 #include <linux/init.h>      // for __init, see code
 #include <linux/interrupt.h> // for interrupt handling
 #include <linux/kernel.h>
+#include <linux/kthread.h>    // for the sampling thread
+#include <linux/list.h>       // for the list of open files
 #include <linux/miscdevice.h> // for misc_device_register and struct miscdev
+#include <linux/mm.h>         // for struct vm_area_struct
 #include <linux/module.h>     // for module init and exit macros
+#include <linux/mutex.h>
+#include <linux/poll.h> // for poll_wait
+#include <linux/sched.h>
+#include <linux/seq_file.h> // for the statistics
+#include <linux/slab.h>     // for the per-file state
+#include <linux/sort.h>     // for calibration
+#include <linux/spinlock.h> // for the event queue
 #include <linux/time.h>
 #include <linux/uaccess.h> // for copy_to_user, see code
+#include <linux/vmalloc.h> // for the (mmap-able) sample ring
+#include <linux/wait.h>    // for the reader wait queue
+#include <linux/workqueue.h> // for calibration
 
+#include "../accel_uapi.h"
 #include "../address_map_arm.h"
-#include "ADXL345.h"
+
+#define CREATE_TRACE_POINTS
+#include "accel_trace.h"
+
+// Trace, and account for, every I2C transfer (see the statistics below).
+static void AccelStatXfer(bool Read, uint8_t Address, unsigned int Bytes,
+                          uint64_t StartNs, int Status);
+#define ADXL345_XFER_START(Read, Address, Bytes)                               \
+  trace_accel_i2c_start(Read, Address, Bytes)
+#define ADXL345_XFER_DONE(Read, Address, Bytes, StartNs, Status)               \
+  AccelStatXfer(Read, Address, Bytes, StartNs, Status)
+#include "../ADXL345.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Nicholas Giamblanco");
@@ -47,11 +75,358 @@ volatile unsigned int *I2C0Virt;
 static int16_t MGPerLSB;
 static uint8_t DevID;
 
-#define ACCEL_READ_BUF_SIZE 21 // RR XXXX YYYY ZZZZ SS
-static char ACCEL_READ_BUF[ACCEL_READ_BUF_SIZE] = "-- No Data Ready. --";
-
+#define ACCEL_READ_BUF_SIZE 64 // RR XXXX YYYY ZZZZ SS NNNN TTTT
 #define ACCEL_WRITE_BUF_SIZE 40
-static char ACCEL_WRITE_BUF[ACCEL_WRITE_BUF_SIZE] = {'\0'};
+
+// The most recent sample taken from the ADXL345. Its XYZ values are kept
+// when a tap is reported without new data.
+static struct AccelSample LastSample;
+
+// The current BW_RATE code, used to pace the sampling thread.
+static uint8_t AccelRate = XL345_RATE_12_5;
+
+// The current DATA_FORMAT value and tap/activity thresholds.
+// These start out as (and are reset by "init" to) what ADXL345_Init writes.
+static uint8_t AccelFormatReg = XL345_RANGE_16G;
+#define ACCEL_DEFAULT_THRESHOLDS                                               \
+  {                                                                            \
+    .ThreshTap = 48, .Dur = 32, .Latent = 16, .Window = 240, .TapAxes = 0x01,  \
+    .ThreshAct = 0x04, .ThreshInact = 0x02, .TimeInact = 0x02,                 \
+    .ActInactCtl = 0xFF                                                        \
+  }
+static struct AccelThresholds AccelThresh = ACCEL_DEFAULT_THRESHOLDS;
+
+// How the ADXL345 FIFO is used (ACCEL_FIFO_*), and its watermark.
+static uint8_t AccelFifoMode = ACCEL_FIFO_BYPASS;
+static uint8_t AccelFifoWatermark = 16;
+
+// Serializes all I2C0 traffic (sampling thread vs. commands).
+static DEFINE_MUTEX(AccelBusLock);
+
+// Sample Ring Buffer:
+// The sampling thread fills the ring at the configured output data rate,
+// independently of readers. The ring lives in vmalloc_user() memory so it
+// can also be mapped into user space (see AccelDevMmap): it starts with a
+// struct AccelRingHeader, followed by ACCEL_RING_SIZE sample slots.
+//
+// The head (AccelRingHdr->Head) and each open file's RingTail are free
+// running counters (the slot is Counter & ACCEL_RING_MASK), so (Head -
+// RingTail) is the number of samples that file hasn't read. One slot is
+// always kept free for the producer to write into, so at most
+// ACCEL_RING_SIZE - 1 samples are unread.
+//
+// The producer only ever moves the head; read() only ever moves its file's
+// RingTail, so every reader consumes the one sampled stream at its own
+// pace. With ACCEL_OVERFLOW_OVERWRITE a slow reader notices that the head
+// has lapped it and skips forward, with ACCEL_OVERFLOW_DROP the producer
+// discards new samples while the slowest reader's backlog is full.
+#define ACCEL_RING_SIZE 1024 // Must be a power of two.
+#define ACCEL_RING_MASK (ACCEL_RING_SIZE - 1)
+#define ACCEL_RING_USABLE (ACCEL_RING_SIZE - 1)
+#define ACCEL_RING_BYTES PAGE_ALIGN(ACCEL_RING_MAP_SIZE(ACCEL_RING_SIZE))
+static void *AccelRingMem;
+static struct AccelRingHeader *AccelRingHdr;
+static struct AccelSample *AccelRing;
+
+static int AccelOverflowPolicy = ACCEL_OVERFLOW_OVERWRITE;
+static atomic_t AccelOverflows = ATOMIC_INIT(0);
+
+// Event Queue:
+// INT_SOURCE events are cleared when read, so every event the sampling path
+// sees is queued here with a timestamp. Each open file has its own position
+// (struct AccelFile's EventTail), so every reader gets every event once.
+// AccelEventHead is a free running counter; a file which falls more than
+// ACCEL_EVENT_RING_SIZE events behind skips the oldest ones.
+#define ACCEL_EVENT_RING_SIZE 256 // Must be a power of two.
+#define ACCEL_EVENT_RING_MASK (ACCEL_EVENT_RING_SIZE - 1)
+static struct AccelEvent AccelEventRing[ACCEL_EVENT_RING_SIZE];
+static unsigned int AccelEventHead;
+static DEFINE_SPINLOCK(AccelEventLock);
+
+// State kept for each open file (in its private_data).
+struct AccelFile {
+  struct list_head Node;   // In AccelFiles
+  struct mutex Lock;       // Serializes reads and writes of this file
+  unsigned long Mode;      // ACCEL_MODE_*
+  unsigned int RingTail;   // Next sample to return to this file
+  bool Reading;            // Set once the file has read samples
+  unsigned int EventTail;  // Next event to report to this file
+  unsigned int EventsLost; // Events skipped because the file fell behind
+  char ReadBuf[ACCEL_READ_BUF_SIZE];
+  char WriteBuf[ACCEL_WRITE_BUF_SIZE];
+};
+
+// Every open file (for the slowest reader, see AccelRingBacklog).
+static LIST_HEAD(AccelFiles);
+static DEFINE_SPINLOCK(AccelFilesLock);
+
+static struct task_struct *AccelSamplerTask;
+
+// Calibration:
+// Runs in the background (on the system workqueue), from the samples the
+// sampling path pushes into the ring, so neither the caller nor the other
+// readers are held up. AccelCalFile is its own cursor into the ring.
+static void AccelCalibrate(struct work_struct *Work);
+static DECLARE_WORK(AccelCalWork, AccelCalibrate);
+static struct AccelFile AccelCalFile;
+static unsigned int AccelCalSamples = ACCEL_CALIBRATE_DEFAULT;
+// Times a calibration starts over after the data format was changed under it.
+#define ACCEL_CAL_ATTEMPTS 3
+static atomic_t AccelCalBusy = ATOMIC_INIT(0);
+static bool AccelCalCancel;
+
+// ADXL345 Interrupt:
+// If the GPIO wired to the ADXL345's interrupt pin is given (irq_gpio), new
+// samples and events are fetched by a threaded interrupt handler, and there
+// is no I2C traffic while the board is idle. Otherwise (or if the interrupt
+// cannot be set up) the sampling thread polls the ADXL345 instead.
+static int AccelIrqGpio = -1;
+module_param_named(irq_gpio, AccelIrqGpio, int, 0444);
+MODULE_PARM_DESC(irq_gpio, "GPIO wired to the ADXL345 interrupt (-1: poll)");
+
+static int AccelIntPin = 1;
+module_param_named(int_pin, AccelIntPin, int, 0444);
+MODULE_PARM_DESC(int_pin, "ADXL345 interrupt pin wired to irq_gpio (1 or 2)");
+
+static int AccelIrq = -1;
+
+// Readers sleep here until the sampling thread pushes a sample.
+static DECLARE_WAIT_QUEUE_HEAD(AccelReadQueue);
+
+// Report the number of samples lost to overflow in
+// /sys/module/accel/parameters/overflows
+static int AccelOverflowsGet(char *Buffer, const struct kernel_param *KP) {
+  return sprintf(Buffer, "%d\n", atomic_read(&AccelOverflows));
+}
+
+static const struct kernel_param_ops AccelOverflowsOps = {
+    .get = AccelOverflowsGet};
+module_param_cb(overflows, &AccelOverflowsOps, NULL, 0444);
+MODULE_PARM_DESC(overflows, "Samples lost because the ring buffer was full");
+
+// Report the number of failed I2C transfers of the sampling path in
+// /sys/module/accel/parameters/bus_errors
+static atomic_t AccelBusErrors = ATOMIC_INIT(0);
+
+static int AccelBusErrorsGet(char *Buffer, const struct kernel_param *KP) {
+  return sprintf(Buffer, "%d\n", atomic_read(&AccelBusErrors));
+}
+
+static const struct kernel_param_ops AccelBusErrorsOps = {
+    .get = AccelBusErrorsGet};
+module_param_cb(bus_errors, &AccelBusErrorsOps, NULL, 0444);
+MODULE_PARM_DESC(bus_errors, "I2C transfers which failed while sampling");
+
+// Statistics:
+// Counters, and log2 histograms of the time each I2C transfer takes and of
+// the time from a sample's acquisition to its copy_to_user (the newest
+// sample of each read). They are all atomics (no locks), so they are left
+// on. They can be read (and reset, by writing anything) from
+// /sys/kernel/debug/accel/stats.
+enum AccelStat {
+  ACCEL_STAT_READS,          // read() calls
+  ACCEL_STAT_READ_BYTES,     // Bytes returned by read()
+  ACCEL_STAT_XFERS,          // I2C transfers
+  ACCEL_STAT_XFER_BYTES,     // Bytes on the wire (incl. addresses)
+  ACCEL_STAT_XFER_ERRORS,    // Failed I2C transfers
+  ACCEL_STAT_POLLS,          // Times the sampling path checked INT_SOURCE
+  ACCEL_STAT_SAMPLES,        // Samples acquired
+  ACCEL_STAT_DATAREADY_MISS, // Polls which found no new sample
+  ACCEL_STAT_OVERRUNS,       // FIFO overruns reported by the ADXL345
+  ACCEL_STATS
+};
+
+static const char *const AccelStatNames[ACCEL_STATS] = {
+    "reads", "read_bytes", "i2c_xfers",        "i2c_bytes", "i2c_errors",
+    "polls", "samples",    "dataready_misses", "overruns"};
+
+// Bucket i counts times in [2^(i - 1), 2^i) ns (bucket 0: 0 ns), and the last
+// bucket everything longer.
+#define ACCEL_HIST_BUCKETS 32
+
+static atomic_long_t AccelStats[ACCEL_STATS];
+static atomic_long_t AccelXferHist[ACCEL_HIST_BUCKETS];
+static atomic_long_t AccelCopyHist[ACCEL_HIST_BUCKETS];
+static struct dentry *AccelDebugDir;
+
+static inline void AccelStatAdd(enum AccelStat Stat, long Value) {
+  atomic_long_add(Value, &AccelStats[Stat]);
+}
+
+static inline void AccelHistAdd(atomic_long_t *Hist, uint64_t Ns) {
+  atomic_long_inc(&Hist[min(fls64(Ns), ACCEL_HIST_BUCKETS - 1)]);
+}
+
+static void AccelStatXfer(bool Read, uint8_t Address, unsigned int Bytes,
+                          uint64_t StartNs, int Status) {
+  uint64_t DurationNs = ktime_get_ns() - StartNs;
+
+  trace_accel_i2c_done(Read, Address, Bytes, DurationNs, Status);
+  AccelStatAdd(ACCEL_STAT_XFERS, 1);
+  AccelStatAdd(ACCEL_STAT_XFER_BYTES, Bytes);
+  if (Status)
+    AccelStatAdd(ACCEL_STAT_XFER_ERRORS, 1);
+  AccelHistAdd(AccelXferHist, DurationNs);
+}
+
+static void AccelShowHist(struct seq_file *Seq, const char *Name,
+                          atomic_long_t *Hist) {
+  long Count;
+  int i;
+
+  seq_printf(Seq, "%s (ns):\n", Name);
+  for (i = 0; i < ACCEL_HIST_BUCKETS; i++) {
+    Count = atomic_long_read(&Hist[i]);
+    if (!Count)
+      continue;
+    if (i == ACCEL_HIST_BUCKETS - 1)
+      seq_printf(Seq, "  >= %10llu: %ld\n", 1ULL << (i - 1), Count);
+    else
+      seq_printf(Seq, "  < %11llu: %ld\n", 1ULL << i, Count);
+  }
+}
+
+static int AccelStatsShow(struct seq_file *Seq, void *Data) {
+  int i;
+
+  for (i = 0; i < ACCEL_STATS; i++)
+    seq_printf(Seq, "%s: %ld\n", AccelStatNames[i],
+               atomic_long_read(&AccelStats[i]));
+  AccelShowHist(Seq, "i2c_xfer_latency", AccelXferHist);
+  AccelShowHist(Seq, "sample_to_copy_latency", AccelCopyHist);
+  return 0;
+}
+
+static int AccelStatsOpen(struct inode *Inode, struct file *FilP) {
+  return single_open(FilP, AccelStatsShow, NULL);
+}
+
+// Writing anything resets the statistics.
+static ssize_t AccelStatsWrite(struct file *FilP, const char __user *Buffer,
+                               size_t Length, loff_t *Offset) {
+  int i;
+
+  for (i = 0; i < ACCEL_STATS; i++)
+    atomic_long_set(&AccelStats[i], 0);
+  for (i = 0; i < ACCEL_HIST_BUCKETS; i++) {
+    atomic_long_set(&AccelXferHist[i], 0);
+    atomic_long_set(&AccelCopyHist[i], 0);
+  }
+  return Length;
+}
+
+static const struct file_operations AccelStatsFops = {
+    .owner = THIS_MODULE,
+    .open = AccelStatsOpen,
+    .read = seq_read,
+    .write = AccelStatsWrite,
+    .llseek = seq_lseek,
+    .release = single_release};
+
+// Calibration Offsets:
+// AccelCalibrated is set once the offset registers hold a calibration
+// (computed, or restored). The "offsets" parameter exports them as
+// "DEVID:X,Y,Z" (empty until calibrated); passing that back to insmod
+// restores them instead of calibrating, so sampling starts right away.
+// Writing the parameter later restores them immediately.
+static bool AccelCalibrated;
+static bool AccelStarted;
+static struct AccelOffsets AccelSavedOffsets;
+static bool AccelHaveSavedOffsets;
+
+// Parse "DEVID:X,Y,Z" (DEVID in hex, X, Y and Z in -128 - 127).
+// Returns 0, or -EINVAL.
+static int AccelParseOffsets(const char *Str, struct AccelOffsets *Offsets) {
+  unsigned int ID;
+  int X, Y, Z;
+
+  if (sscanf(Str, "%x:%d,%d,%d", &ID, &X, &Y, &Z) < 4)
+    return -EINVAL;
+  if (X < -128 || X > 127 || Y < -128 || Y > 127 || Z < -128 || Z > 127)
+    return -EINVAL;
+  memset(Offsets, 0, sizeof(*Offsets));
+  Offsets->DevId = ID;
+  Offsets->X = X;
+  Offsets->Y = Y;
+  Offsets->Z = Z;
+  return 0;
+}
+
+// Read the current offsets (with AccelBusLock held).
+static int AccelGetOffsets(struct AccelOffsets *Offsets) {
+  int8_t Regs[3];
+  int Status;
+
+  memset(Offsets, 0, sizeof(*Offsets));
+  Status = ADXL345_GetOffsets(Regs);
+  if (Status)
+    return Status;
+  Offsets->DevId = DevID;
+  Offsets->X = Regs[0];
+  Offsets->Y = Regs[1];
+  Offsets->Z = Regs[2];
+  Offsets->Calibrated = AccelCalibrated;
+  return 0;
+}
+
+// Restore saved offsets (with AccelBusLock held).
+// Returns 0, -ENODEV if they were taken from a different device, or a bus
+// error.
+static int AccelRestoreOffsets(const struct AccelOffsets *Offsets) {
+  const int8_t Regs[3] = {Offsets->X, Offsets->Y, Offsets->Z};
+  int Status;
+
+  if (Offsets->DevId != DevID)
+    return -ENODEV;
+  Status = ADXL345_SetOffsets(Regs);
+  if (!Status)
+    AccelCalibrated = true;
+  return Status;
+}
+
+static int AccelOffsetsSet(const char *Value, const struct kernel_param *KP) {
+  struct AccelOffsets Offsets;
+  int Status;
+
+  // An empty value forgets the saved offsets.
+  if (!*Value || *Value == '\n') {
+    AccelHaveSavedOffsets = false;
+    return 0;
+  }
+  Status = AccelParseOffsets(Value, &Offsets);
+  if (Status)
+    return Status;
+  AccelSavedOffsets = Offsets;
+  AccelHaveSavedOffsets = true;
+  if (!AccelStarted)
+    return 0; // Restored by init_accel.
+  mutex_lock(&AccelBusLock);
+  Status = AccelRestoreOffsets(&Offsets);
+  mutex_unlock(&AccelBusLock);
+  return Status;
+}
+
+static int AccelOffsetsGet(char *Buffer, const struct kernel_param *KP) {
+  struct AccelOffsets Offsets;
+  int Status;
+
+  if (!AccelStarted)
+    return sprintf(Buffer, "\n");
+  mutex_lock(&AccelBusLock);
+  Status = AccelGetOffsets(&Offsets);
+  mutex_unlock(&AccelBusLock);
+  if (Status)
+    return Status;
+  if (!Offsets.Calibrated)
+    return sprintf(Buffer, "\n");
+  return sprintf(Buffer, "%02x:%d,%d,%d\n", Offsets.DevId, Offsets.X,
+                 Offsets.Y, Offsets.Z);
+}
+
+static const struct kernel_param_ops AccelOffsetsOps = {
+    .set = AccelOffsetsSet, .get = AccelOffsetsGet};
+module_param_cb(offsets, &AccelOffsetsOps, NULL, 0644);
+MODULE_PARM_DESC(offsets, "Calibration offsets to restore (DEVID:X,Y,Z)");
 
 // Declare the methods the video device driver will require.
 // NOTE: we only need to read from the driver to understand the
@@ -60,11 +435,18 @@ static int AccelDevOpen(struct inode *, struct file *);
 static int AccelDevRelease(struct inode *, struct file *);
 static ssize_t AccelDevRead(struct file *, char *, size_t, loff_t *);
 static ssize_t AccelDevWrite(struct file *, const char *, size_t, loff_t *);
+static int AccelDevMmap(struct file *, struct vm_area_struct *);
+static unsigned int AccelDevPoll(struct file *, poll_table *);
+static long AccelDevIoctl(struct file *, unsigned int, unsigned long);
 
 // Define the File Operations for /dev/accel
 static struct file_operations AccelDevFops = {.owner = THIS_MODULE,
+                                              .llseek = no_llseek,
                                               .read = AccelDevRead,
                                               .write = AccelDevWrite,
+                                              .mmap = AccelDevMmap,
+                                              .poll = AccelDevPoll,
+                                              .unlocked_ioctl = AccelDevIoctl,
                                               .open = AccelDevOpen,
                                               .release = AccelDevRelease};
 
@@ -86,91 +468,723 @@ static struct miscdevice AccelDev = {.minor = MISC_DYNAMIC_MINOR,
 
 static int AccelDevRegistered = NOT_REGISTERED;
 
-void AccelDataToStr(void) {
-  int i;
-  int16_t XYZ[3];
+// Count samples lost to overflow (also visible in the ring header).
+static void AccelCountOverflows(unsigned int Lost) {
+  atomic_add(Lost, &AccelOverflows);
+  WRITE_ONCE(AccelRingHdr->Overflows, atomic_read(&AccelOverflows));
+}
 
-  char InterruptStatusStr[5] = {'\0'};
-  char AccelDataStr[15] = {'\0'};
-  char ScaleStr[3] = {'\0'};
-  char AccelReadBufTemp[23] = {'\0'};
+// Returns the number of samples the slowest reader has yet to read. Files
+// which have never read a sample (e.g., only used to write commands) don't
+// count.
+static unsigned int AccelRingBacklog(unsigned int Head) {
+  struct AccelFile *File;
+  unsigned int Backlog = 0;
 
-  uint8_t InterruptFlags = ADXL345_WhichInterrupts();
+  spin_lock(&AccelFilesLock);
+  list_for_each_entry(File, &AccelFiles, Node) {
+    if (READ_ONCE(File->Reading))
+      Backlog = max(Backlog, Head - READ_ONCE(File->RingTail));
+  }
+  spin_unlock(&AccelFilesLock);
+  return Backlog;
+}
 
-  // As one of the requirements, we may not have a data update,
-  // however, we may have interrupt update. Therefore, we wish to
-  // to update the interrupt portion of the string. To do so, we create a
-  // a temporary buffer which is a copy of our original string buffer. All
-  // updates are performed on the temporary string such that any error will
-  // result in NO change to the original string.
-  strcpy(AccelReadBufTemp, ACCEL_READ_BUF);
+// Append a sample to the ring (called by the sampling thread only).
+// If the slowest reader's backlog is full, a sample is lost: the new one in
+// drop mode, the oldest one that reader hasn't read otherwise. It is counted
+// once here, however many readers miss it.
+void AccelRingPush(const struct AccelSample *Sample) {
+  unsigned int Head = AccelRingHdr->Head;
 
-  // First, Read in the interrupt register into the string.
-  if (snprintf(InterruptStatusStr, 3, "%02x\n", InterruptFlags) < 0) {
-    printk(KERN_ERR "Error [%s]: snprintf was unsuccessful", ACCEL_DEV_NAME);
+  if (AccelRingBacklog(Head) >= ACCEL_RING_USABLE) {
+    AccelCountOverflows(1);
+    if (AccelOverflowPolicy == ACCEL_OVERFLOW_DROP)
+      return;
+  }
+  AccelRing[Head & ACCEL_RING_MASK] = *Sample;
+  // Publish the sample only once it has been completely written.
+  WRITE_ONCE(AccelRingHdr->Seq, Sample->Seq);
+  WRITE_ONCE(AccelRingHdr->Tail,
+             Head + 1 - min_t(unsigned int, Head + 1, ACCEL_RING_USABLE));
+  smp_store_release(&AccelRingHdr->Head, Head + 1);
+  trace_accel_sample(Sample);
+}
+
+// Queue one event for each flag set in Events.
+static void AccelQueueEvents(uint8_t Events, int16_t Error, uint64_t Now,
+                             uint32_t Seq) {
+  struct AccelEvent *Event;
+  unsigned long Flags;
+  uint8_t Bit;
+
+  spin_lock_irqsave(&AccelEventLock, Flags);
+  for (Bit = 0x80; Bit; Bit >>= 1) {
+    if (!(Events & Bit))
+      continue;
+    Event = &AccelEventRing[AccelEventHead & ACCEL_EVENT_RING_MASK];
+    memset(Event, 0, sizeof(*Event));
+    Event->Timestamp = Now;
+    Event->Seq = Seq;
+    Event->Type = Bit;
+    Event->Error = Error;
+    AccelEventHead++;
+  }
+  spin_unlock_irqrestore(&AccelEventLock, Flags);
+}
+
+// Returns the number of events File hasn't seen yet, skipping past (and
+// counting) any which have been overwritten.
+// NOTE: The caller must hold AccelEventLock.
+static unsigned int AccelEventsUnread(struct AccelFile *File) {
+  unsigned int Unread = AccelEventHead - File->EventTail;
+
+  if (Unread > ACCEL_EVENT_RING_SIZE) {
+    File->EventsLost += Unread - ACCEL_EVENT_RING_SIZE;
+    File->EventTail = AccelEventHead - ACCEL_EVENT_RING_SIZE;
+    Unread = ACCEL_EVENT_RING_SIZE;
+  }
+  return Unread;
+}
+
+// Take up to Max of File's unread events (oldest first) into Events.
+// Returns the number taken.
+static unsigned int AccelTakeEvents(struct AccelFile *File,
+                                    struct AccelEvent *Events,
+                                    unsigned int Max) {
+  unsigned int Count;
+  unsigned int i;
+  unsigned long Flags;
+
+  spin_lock_irqsave(&AccelEventLock, Flags);
+  Count = min(AccelEventsUnread(File), Max);
+  for (i = 0; i < Count; ++i)
+    Events[i] = AccelEventRing[(File->EventTail + i) & ACCEL_EVENT_RING_MASK];
+  File->EventTail += Count;
+  spin_unlock_irqrestore(&AccelEventLock, Flags);
+  return Count;
+}
+
+// Take all of File's unread events, returning their (OR'ed) INT_SOURCE
+// flags. Driver events (ACCEL_EVENT_CALIBRATED) have no INT_SOURCE flag,
+// and are only reported by ACCEL_IOC_READ_EVENTS.
+static uint8_t AccelTakeEventFlags(struct AccelFile *File) {
+  uint8_t Events = 0;
+  unsigned long Flags;
+
+  spin_lock_irqsave(&AccelEventLock, Flags);
+  AccelEventsUnread(File);
+  while (File->EventTail != AccelEventHead)
+    Events |= AccelEventRing[File->EventTail++ & ACCEL_EVENT_RING_MASK].Type;
+  spin_unlock_irqrestore(&AccelEventLock, Flags);
+  return Events & ACCEL_EVENTS;
+}
+
+// Returns true if File has events waiting (no lock needed).
+static bool AccelFileHasEvents(struct AccelFile *File) {
+  return READ_ONCE(AccelEventHead) != READ_ONCE(File->EventTail);
+}
+
+// Fetch every new sample from the ADXL345 and push them into the ring.
+// In bypass mode that is (at most) the sample in the data registers; in
+// stream mode, all samples waiting in the FIFO are read back-to-back (by
+// ADXL345_DrainFifo, in the shared core). FIFO samples are one output data period apart, so they are timestamped
+// backwards from the newest one.
+//
+// Events (taps, activity, ..., overrun) are queued in the event queue, and
+// also reported in the status of the first sample. Events seen without new
+// data are reported immediately, with the previous XYZ and without
+// DATA_READY set.
+// A failed transfer ends the acquisition (and is counted in bus_errors).
+// Returns the number of records pushed, or -EIO if INT_SOURCE couldn't be
+// read (so the ADXL345's interrupt is still pending).
+// NOTE: The caller must hold AccelBusLock.
+static int AccelAcquireSamples(void) {
+  int16_t XYZ[ADXL345_DRAIN_MAX][3];
+  uint8_t InterruptFlags;
+  uint8_t Events;
+  unsigned int Entries;
+  unsigned int i;
+  int Count;
+  int Error;
+  uint64_t Now = ktime_get_ns();
+  uint64_t PeriodNs = XL345_RATE_PERIOD_US(AccelRate) * 1000ULL;
+
+  // INT_SOURCE and every new sample (the whole FIFO in stream mode).
+  AccelStatAdd(ACCEL_STAT_POLLS, 1);
+  Count = ADXL345_DrainFifo(XYZ, ADXL345_DRAIN_MAX,
+                            AccelFifoMode == ACCEL_FIFO_STREAM,
+                            &InterruptFlags, &Error);
+  if (Count < 0 || Error)
+    atomic_inc(&AccelBusErrors);
+  if (Count < 0)
+    return -EIO;
+  Entries = Count;
+  if (InterruptFlags & XL345_OVERRUN)
+    AccelStatAdd(ACCEL_STAT_OVERRUNS, 1);
+  // Consume every event latched so far.
+  Events = ADXL345_TakeEvents(XL345_EVENTS) | (InterruptFlags & XL345_OVERRUN);
+  if (Events)
+    AccelQueueEvents(Events, 0, Now, LastSample.Seq);
+
+  if (!Entries) {
+    AccelStatAdd(ACCEL_STAT_DATAREADY_MISS, 1);
+    if (!Events)
+      return 0;
+    LastSample.Timestamp = Now;
+    LastSample.Status = Events;
+    LastSample.Scale = MGPerLSB;
+    AccelRingPush(&LastSample);
+    return 1;
+  }
+
+  for (i = 0; i < Entries; ++i) {
+    LastSample.X = XYZ[i][0];
+    LastSample.Y = XYZ[i][1];
+    LastSample.Z = XYZ[i][2];
+    LastSample.Seq++;
+    LastSample.Timestamp = Now - (Entries - 1 - i) * PeriodNs;
+    // Events are reported once, with the first sample.
+    LastSample.Status = XL345_DATAREADY | (i ? 0 : Events);
+    LastSample.Scale = MGPerLSB;
+    AccelRingPush(&LastSample);
+  }
+  AccelStatAdd(ACCEL_STAT_SAMPLES, i);
+  return i;
+}
+
+// Returns the number of samples File hasn't read, skipping its tail
+// forward past any samples which have been overwritten.
+// NOTE: The caller must hold File->Lock.
+static unsigned int AccelRingAvailable(struct AccelFile *File) {
+  unsigned int Head = smp_load_acquire(&AccelRingHdr->Head);
+
+  // (The producer counted the overwritten samples as overflows.)
+  if (Head - File->RingTail > ACCEL_RING_USABLE)
+    WRITE_ONCE(File->RingTail, Head - ACCEL_RING_USABLE);
+  return Head - File->RingTail;
+}
+
+// Returns true if File has samples waiting (no lock needed).
+static bool AccelRingHasData(struct AccelFile *File) {
+  return smp_load_acquire(&AccelRingHdr->Head) != READ_ONCE(File->RingTail);
+}
+
+// Returns true if the producer has started overwriting the sample at File's
+// tail (i.e., while it was being copied out).
+static bool AccelRingLapped(struct AccelFile *File) {
+  return smp_load_acquire(&AccelRingHdr->Head) - File->RingTail >
+         ACCEL_RING_USABLE;
+}
+
+// Copy up to Max whole samples File hasn't read from the ring to user space.
+// Returns the number of bytes copied, or -EFAULT.
+// NOTE: The caller must hold File->Lock.
+static ssize_t AccelRingRead(struct AccelFile *File, char *Buffer,
+                             unsigned int Max) {
+  unsigned int Count;
+  unsigned int First;
+  unsigned int Slot;
+  uint64_t Newest;
+  uint32_t NewestSeq;
+
+  do {
+    Count = min(AccelRingAvailable(File), Max);
+    Slot = File->RingTail & ACCEL_RING_MASK;
+    Newest = AccelRing[(Slot + Count - 1) & ACCEL_RING_MASK].Timestamp;
+    NewestSeq = AccelRing[(Slot + Count - 1) & ACCEL_RING_MASK].Seq;
+    // The unread samples may wrap around the end of the ring.
+    First = min(Count, ACCEL_RING_SIZE - Slot);
+    if (copy_to_user(Buffer, &AccelRing[Slot],
+                     First * sizeof(struct AccelSample)) ||
+        copy_to_user(Buffer + First * sizeof(struct AccelSample), AccelRing,
+                     (Count - First) * sizeof(struct AccelSample)))
+      return -EFAULT;
+    // If we were lapped during the copy, the copy may be torn: try again.
+  } while (Count && AccelRingLapped(File));
+  if (Count) {
+    trace_accel_deliver(NewestSeq, Newest, Count);
+    AccelHistAdd(AccelCopyHist, ktime_get_ns() - Newest);
+  }
+  WRITE_ONCE(File->RingTail, File->RingTail + Count);
+  return Count * sizeof(struct AccelSample);
+}
+
+// Take the oldest sample File hasn't read from the ring.
+// Returns false (and leaves Sample untouched) if there is none.
+// NOTE: The caller must hold File->Lock.
+static bool AccelRingPop(struct AccelFile *File, struct AccelSample *Sample) {
+  bool Popped = false;
+
+  do {
+    if (!AccelRingAvailable(File))
+      break;
+    *Sample = AccelRing[File->RingTail & ACCEL_RING_MASK];
+    Popped = true;
+  } while (AccelRingLapped(File));
+  if (Popped)
+    WRITE_ONCE(File->RingTail, File->RingTail + 1);
+  return Popped;
+}
+
+// The sampling thread: pushes every new sample into the ring.
+// In bypass mode it polls the ADXL345 at twice the output data rate (so no
+// sample is missed). In stream mode it only wakes up about twice per
+// watermark's worth of samples, and drains the FIFO in one pass.
+static int AccelSampler(void *Data) {
+  unsigned int PeriodUs;
+  int Pushed;
+
+  while (!kthread_should_stop()) {
+    mutex_lock(&AccelBusLock);
+    Pushed = AccelAcquireSamples();
+    PeriodUs = XL345_RATE_PERIOD_US(AccelRate);
+    if (AccelFifoMode == ACCEL_FIFO_STREAM)
+      PeriodUs *= AccelFifoWatermark;
+    mutex_unlock(&AccelBusLock);
+
+    if (Pushed > 0)
+      wake_up_interruptible(&AccelReadQueue);
+
+    usleep_range(PeriodUs / 2, PeriodUs / 2 + PeriodUs / 8);
+  }
+  return 0;
+}
+
+// If the interrupt handler can't clear the ADXL345's interrupt, it falls
+// back to the sampling thread (which backs off between polls).
+static void AccelFallBackToPolling(struct work_struct *Work) {
+  struct task_struct *Task;
+
+  Task = kthread_run(AccelSampler, NULL, "%s-sampler", ACCEL_DEV_NAME);
+  if (IS_ERR(Task)) {
+    printk(KERN_ERR "Error [%s]: could not start the sampling thread\n",
+           ACCEL_DEV_NAME);
     return;
   }
-  // Copy this into the AccelReadBufTemp
-  for (i = 0; i < 2; ++i) {
-    AccelReadBufTemp[i] = InterruptStatusStr[i];
+  AccelSamplerTask = Task;
+}
+static DECLARE_WORK(AccelPollWork, AccelFallBackToPolling);
+
+// Threaded interrupt handler: the ADXL345 raised its interrupt line, so
+// fetch the new samples/events (this also clears the interrupt).
+static irqreturn_t AccelIrqThread(int Irq, void *DevId) {
+  int Pushed;
+
+  mutex_lock(&AccelBusLock);
+  Pushed = AccelAcquireSamples();
+  mutex_unlock(&AccelBusLock);
+
+  if (Pushed < 0) {
+    // The transfer failed (and the bus was recovered), but the level
+    // triggered line is still asserted: unmasking it would retry the bus
+    // forever. Keep it disabled, and poll instead.
+    printk(KERN_WARNING "/dev/%s: bus error in the interrupt handler, "
+                        "polling from now on\n",
+           ACCEL_DEV_NAME);
+    disable_irq_nosync(Irq);
+    schedule_work(&AccelPollWork);
+  } else if (Pushed)
+    wake_up_interruptible(&AccelReadQueue);
+  return IRQ_HANDLED;
+}
+
+// Enable the ADXL345 interrupts we need, on the configured pin. When
+// interrupt driven, that includes new data: DATA_READY in bypass mode, or
+// WATERMARK (and OVERRUN) in stream mode.
+// Returns 0, or a negative error code.
+// NOTE: The caller must hold AccelBusLock.
+static int AccelSetInterrupts(void) {
+  uint8_t Enable =
+      XL345_SINGLETAP | XL345_DOUBLETAP | XL345_ACTIVITY | XL345_INACTIVITY;
+
+  if (AccelIrq >= 0) {
+    if (AccelFifoMode == ACCEL_FIFO_STREAM)
+      Enable |= XL345_WATERMARK | XL345_OVERRUN;
+    else
+      Enable |= XL345_DATAREADY;
   }
+  return ADXL345_SetInterrupts(Enable, AccelIntPin == 2 ? 0xFF : 0x00);
+}
 
-  // If Data is ready, update the portion of the string
-  // with fresh data.
-  if (InterruptFlags & XL345_DATAREADY) {
-    // Read the XYZ values.
-    ADXL345_XYZ_Read(XYZ);
-    // Format these values into a string buffer.
-    if (snprintf(AccelDataStr, 15, "%04d %04d %04d\n", XYZ[0], XYZ[1], XYZ[2]) <
-        0) {
-      printk(KERN_ERR "Error [%s]: snprintf was unsuccessful", ACCEL_DEV_NAME);
-      return;
+// Request the interrupt of the GPIO wired to the ADXL345.
+// Returns 0 on success (AccelIrq is then set).
+static int AccelRequestIrq(void) {
+  int Status;
+
+  if (AccelIrqGpio < 0)
+    return -ENODEV;
+
+  Status = gpio_request(AccelIrqGpio, ACCEL_DEV_NAME);
+  if (Status)
+    return Status;
+  Status = gpio_direction_input(AccelIrqGpio);
+  if (!Status)
+    Status = gpio_to_irq(AccelIrqGpio);
+  if (Status < 0) {
+    gpio_free(AccelIrqGpio);
+    return Status;
+  }
+
+  // The ADXL345 holds its (active high) interrupt until INT_SOURCE or the
+  // data is read, so the line is kept masked until the handler has run.
+  AccelIrq = Status;
+  Status = request_threaded_irq(AccelIrq, NULL, AccelIrqThread,
+                                IRQF_TRIGGER_HIGH | IRQF_ONESHOT,
+                                ACCEL_DEV_NAME, &AccelDev);
+  if (Status) {
+    AccelIrq = -1;
+    gpio_free(AccelIrqGpio);
+  }
+  return Status;
+}
+
+static void AccelFreeIrq(void) {
+  if (AccelIrq < 0)
+    return;
+  free_irq(AccelIrq, &AccelDev);
+  gpio_free(AccelIrqGpio);
+  AccelIrq = -1;
+}
+
+// Samples for calibration, in full resolution LSB (3.9 mg: 256 LSB per g,
+// whatever the range).
+struct AccelCalSample {
+  int LSB[3];
+};
+
+static int AccelCompareInt(const void *A, const void *B) {
+  int IntA = *(const int *)A;
+  int IntB = *(const int *)B;
+  return (IntA > IntB) - (IntA < IntB);
+}
+
+// Returns the median of Values[0 .. Count - 1] (which are reordered).
+static int AccelMedian(int *Values, unsigned int Count) {
+  sort(Values, Count, sizeof(int), AccelCompareInt, NULL);
+  return Values[Count / 2];
+}
+
+// Average the samples (in mg), leaving out outliers (e.g., the board was
+// bumped): on every axis, a sample must be within 4 median absolute
+// deviations (and at least 2 LSB) of the median. Fails with -EAGAIN if fewer
+// than half of the samples are left, since the board probably wasn't
+// stationary.
+static int AccelCalAverage(const struct AccelCalSample *Samples,
+                           unsigned int Count, int *Scratch, int AverageMG[3]) {
+  int Median[3];
+  int Limit[3];
+  long Sum[3] = {0, 0, 0};
+  unsigned int Kept = 0;
+  unsigned int Axis;
+  unsigned int i;
+
+  for (Axis = 0; Axis < 3; Axis++) {
+    for (i = 0; i < Count; i++)
+      Scratch[i] = Samples[i].LSB[Axis];
+    Median[Axis] = AccelMedian(Scratch, Count);
+    for (i = 0; i < Count; i++)
+      Scratch[i] = abs(Samples[i].LSB[Axis] - Median[Axis]);
+    Limit[Axis] = max(4 * AccelMedian(Scratch, Count), 2);
+  }
+
+  for (i = 0; i < Count; i++) {
+    for (Axis = 0; Axis < 3; Axis++) {
+      if (abs(Samples[i].LSB[Axis] - Median[Axis]) > Limit[Axis])
+        break;
     }
-    // Copy this
-    for (i = 3; i < 17; ++i) {
-      AccelReadBufTemp[i] = AccelDataStr[i - 3];
+    if (Axis < 3)
+      continue;
+    for (Axis = 0; Axis < 3; Axis++)
+      Sum[Axis] += Samples[i].LSB[Axis];
+    Kept++;
+  }
+  if (Kept < Count / 2)
+    return -EAGAIN;
+  // 1000 / 256 mg per LSB (the sums are at most 1024 * 4096 LSB).
+  for (Axis = 0; Axis < 3; Axis++)
+    AverageMG[Axis] = DIV_ROUND_CLOSEST(Sum[Axis] * 125, (long)Kept * 32);
+  return 0;
+}
+
+// Collect Count new samples from the ring, acquired after SinceNs at
+// CalScale mg/LSB (full resolution). Waits up to twice as long as they should
+// take (plus a second). Fails with -ESTALE if a sample has another scale: a
+// command changed the data format in the meantime.
+static int AccelCalCollect(struct AccelCalSample *Samples, unsigned int Count,
+                           uint64_t SinceNs, int16_t CalScale) {
+  struct AccelSample Sample;
+  uint64_t Deadline;
+  unsigned int Got = 0;
+
+  Deadline = ktime_get_ns() + NSEC_PER_SEC +
+             2ULL * Count * XL345_RATE_PERIOD_US(READ_ONCE(AccelRate)) *
+                 NSEC_PER_USEC;
+  AccelCalFile.RingTail = smp_load_acquire(&AccelRingHdr->Head);
+
+  while (Got < Count) {
+    if (READ_ONCE(AccelCalCancel))
+      return -ECANCELED;
+    if (ktime_get_ns() > Deadline)
+      return -ETIMEDOUT;
+    // Sleep until the sampling path pushes something (or for 100 ms).
+    wait_event_interruptible_timeout(
+        AccelReadQueue,
+        AccelRingHasData(&AccelCalFile) || READ_ONCE(AccelCalCancel),
+        msecs_to_jiffies(100));
+
+    mutex_lock(&AccelCalFile.Lock);
+    while (Got < Count && AccelRingPop(&AccelCalFile, &Sample)) {
+      if (!(Sample.Status & XL345_DATAREADY) || Sample.Timestamp < SinceNs)
+        continue;
+      if (Sample.Scale != CalScale) {
+        mutex_unlock(&AccelCalFile.Lock);
+        return -ESTALE;
+      }
+      Samples[Got].LSB[0] = Sample.X;
+      Samples[Got].LSB[1] = Sample.Y;
+      Samples[Got].LSB[2] = Sample.Z;
+      Got++;
     }
+    mutex_unlock(&AccelCalFile.Lock);
   }
+  return 0;
+}
 
-  // If the MGPerLSB has changed (via a "format") command,
-  // this needs to be reflected during the next read.
-  // Hence, the string is updated with the current scale factor.
-  if (snprintf(ScaleStr, 3, "%02d\n", MGPerLSB) < 0) {
-    printk(KERN_ERR "Error [%s]: snprintf was unsuccessful", ACCEL_DEV_NAME);
-    return;
+// One calibration attempt, from Count samples: switch to full resolution,
+// collect and average the samples, and correct the offsets. Fails with
+// -ESTALE, leaving the offsets and the new format alone, if a command (e.g.,
+// init) changed the data format before it was done.
+static int AccelCalAttempt(struct AccelCalSample *Samples, int *Scratch,
+                           unsigned int Count, int AverageMG[3]) {
+  uint8_t SavedFormat;
+  uint8_t CalFormat;
+  int16_t CalScale;
+  uint64_t SinceNs;
+  int Status;
+  int RestoreStatus = 0;
+
+  mutex_lock(&AccelBusLock);
+  SavedFormat = AccelFormatReg;
+  Status = ADXL345_SetG(true, 2 << (SavedFormat & XL345_RANGE_16G),
+                        &MGPerLSB, &AccelFormatReg);
+  CalFormat = AccelFormatReg;
+  CalScale = MGPerLSB;
+  // Samples converted (or queued in the FIFO) just before the switch are
+  // still in the old format: skip two output data periods.
+  SinceNs = ktime_get_ns() +
+            2ULL * XL345_RATE_PERIOD_US(AccelRate) * NSEC_PER_USEC;
+  mutex_unlock(&AccelBusLock);
+
+  trace_accel_calibrate(ACCEL_CAL_START, Count, Status);
+  if (!Status)
+    Status = AccelCalCollect(Samples, Count, SinceNs, CalScale);
+  if (!Status)
+    Status = AccelCalAverage(Samples, Count, Scratch, AverageMG);
+  trace_accel_calibrate(ACCEL_CAL_AVERAGED, Count, Status);
+
+  mutex_lock(&AccelBusLock);
+  // If the format changed, the samples can't be trusted, and the new format
+  // is the command's to keep.
+  if (AccelFormatReg != CalFormat && Status != -ECANCELED)
+    Status = -ESTALE;
+  if (!Status) {
+    AverageMG[2] -= 1000;
+    Status = ADXL345_CorrectOffsets(AverageMG);
+    if (!Status)
+      AccelCalibrated = true;
   }
-  for (i = 18; i < 20; ++i) {
-    AccelReadBufTemp[i] = ScaleStr[i - 18];
+  if (Status != -ESTALE && AccelFormatReg == CalFormat &&
+      SavedFormat != CalFormat)
+    RestoreStatus = ADXL345_SetG(SavedFormat & XL345_FULL_RESOLUTION,
+                                 2 << (SavedFormat & XL345_RANGE_16G),
+                                 &MGPerLSB, &AccelFormatReg);
+  mutex_unlock(&AccelBusLock);
+  if (RestoreStatus)
+    printk(KERN_WARNING "/dev/%s: could not restore the data format (%d)\n",
+           ACCEL_DEV_NAME, RestoreStatus);
+  return Status;
+}
+
+// The calibration work: the DE1-SoC should be placed on a flat surface, and
+// must remain stationary until it completes. The offsets are corrected so
+// that the board reads 0 g on X and Y, and +1 g on Z. Completion (or
+// failure) is reported to every open file as an ACCEL_EVENT_CALIBRATED
+// event.
+//
+// The samples are taken at full resolution (3.9 mg/LSB, finer than the
+// 15.6 mg/LSB offset registers; 10-bit +/- 16 g is 31 mg/LSB), so the
+// format is switched (keeping the range) for the calibration, and restored
+// afterwards. Readers see the change in the Scale of those samples. If a
+// command changes the format in the meantime (e.g., part3 sending init
+// while the calibration started at load time runs), the calibration starts
+// over from the new format, up to ACCEL_CAL_ATTEMPTS times; then it fails
+// with -EAGAIN.
+static void AccelCalibrate(struct work_struct *Work) {
+  unsigned int Count = AccelCalSamples;
+  unsigned int Attempts = 0;
+  struct AccelCalSample *Samples;
+  int *Scratch;
+  int AverageMG[3];
+  int Status = -ENOMEM;
+
+  Samples = kmalloc_array(Count, sizeof(*Samples), GFP_KERNEL);
+  Scratch = kmalloc_array(Count, sizeof(*Scratch), GFP_KERNEL);
+  if (Samples && Scratch) {
+    do {
+      Status = AccelCalAttempt(Samples, Scratch, Count, AverageMG);
+    } while (Status == -ESTALE && ++Attempts < ACCEL_CAL_ATTEMPTS);
+    if (Status == -ESTALE)
+      Status = -EAGAIN;
   }
+  kfree(Samples);
+  kfree(Scratch);
+
+  if (Status)
+    printk(KERN_WARNING "/dev/%s: calibration failed (%d)\n", ACCEL_DEV_NAME,
+           Status);
+  else
+    printk(KERN_INFO "/dev/%s: calibrated (error was %d, %d, %d mg)\n",
+           ACCEL_DEV_NAME, AverageMG[0], AverageMG[1], AverageMG[2] + 1000);
+  trace_accel_calibrate(ACCEL_CAL_DONE, Count, Status);
+  AccelQueueEvents(ACCEL_EVENT_CALIBRATED, Status, ktime_get_ns(),
+                   READ_ONCE(LastSample.Seq));
+  atomic_set(&AccelCalBusy, 0);
+  wake_up_interruptible(&AccelReadQueue);
+}
 
-  AccelReadBufTemp[20] = '\n';
-  AccelReadBufTemp[21] = '\0';
-  // Finally, copy the updated string back into ACCEL_READ_BUF.
-  strcpy(ACCEL_READ_BUF, AccelReadBufTemp);
+// Start a calibration from Count samples (0 for the default) in the
+// background. If one is already running (e.g., the one started when the
+// driver was loaded), the request joins it: the caller is told of its
+// completion by the same ACCEL_EVENT_CALIBRATED event.
+// Returns 0, or -EINVAL for a bad count.
+static int AccelStartCalibration(unsigned int Count) {
+  if (!Count)
+    Count = ACCEL_CALIBRATE_DEFAULT;
+  if (Count < ACCEL_CALIBRATE_MIN || Count > ACCEL_CALIBRATE_MAX)
+    return -EINVAL;
+  if (atomic_cmpxchg(&AccelCalBusy, 0, 1))
+    return 0;
+  AccelCalSamples = Count;
+  schedule_work(&AccelCalWork);
+  return 0;
 }
 
-void InterpCommand(char *Command) {
+// Format Sample as "RR XXXX YYYY ZZZZ SS NNNN TTTT" into File's read buffer
+// (NNNN is the sequence number, TTTT the timestamp in ns).
+void AccelDataToStr(struct AccelFile *File, const struct AccelSample *Sample) {
+  if (snprintf(File->ReadBuf, ACCEL_READ_BUF_SIZE,
+               "%02x %04d %04d %04d %02d %u %llu\n", Sample->Status,
+               Sample->X, Sample->Y, Sample->Z, Sample->Scale, Sample->Seq,
+               (unsigned long long)Sample->Timestamp) < 0) {
+    printk(KERN_ERR "Error [%s]: snprintf was unsuccessful", ACCEL_DEV_NAME);
+  }
+}
+
+// Switch the ADXL345 FIFO between bypass and stream mode.
+// Returns 0, or a negative error code.
+// NOTE: The caller must hold AccelBusLock.
+static int AccelSetFifo(uint8_t Mode, uint8_t Watermark) {
+  int Status = ADXL345_SetFifo(Mode == ACCEL_FIFO_STREAM
+                                   ? XL345_FIFO_MODE_STREAM
+                                   : XL345_FIFO_MODE_BYPASS,
+                               Watermark);
+  if (Status)
+    return Status;
+  AccelFifoMode = Mode;
+  AccelFifoWatermark = Watermark;
+  return AccelSetInterrupts();
+}
+
+// Process a command written to /dev/accel. Commands which can't be parsed
+// are ignored.
+// Returns 0, or a negative error code if the ADXL345 couldn't be reached.
+int InterpCommand(struct file *FilP, char *Command) {
+  struct AccelFile *File = FilP->private_data;
+  uint8_t Watermark;
   uint8_t Resolution;
   uint8_t Gravity;
   uint16_t Rate;
+  unsigned int Count;
+  struct AccelOffsets Offsets;
+  int Status;
 
   if (strncmp(Command, "init", 4) == 0) {
     // init: re-initializes the ADXL345
     MGPerLSB = ROUNDED_DIVISION(16 * 1000, 512);
-    ADXL345_Init();
-    return;
+    Status = ADXL345_Init();
+    if (Status)
+      return Status;
+    AccelRate = XL345_RATE_12_5;
+    AccelFormatReg = XL345_RANGE_16G;
+    AccelThresh = (struct AccelThresholds)ACCEL_DEFAULT_THRESHOLDS;
+    AccelFifoMode = ACCEL_FIFO_BYPASS;
+    return AccelSetInterrupts();
+  }
+
+  if (strncmp(Command, "offsets", 7) == 0) {
+    // offsets ID:X,Y,Z: restores offsets saved from device ID.
+    // offsets: prints on the Terminal (using printk) the current offsets.
+    if (AccelParseOffsets(Command + 7, &Offsets) == 0)
+      return AccelRestoreOffsets(&Offsets);
+    Status = AccelGetOffsets(&Offsets);
+    if (Status)
+      return Status;
+    printk(KERN_INFO "Accelerometer Offsets: %02x:%d,%d,%d%s\n",
+           Offsets.DevId, Offsets.X, Offsets.Y, Offsets.Z,
+           Offsets.Calibrated ? "" : " (not calibrated)");
+    return 0;
   }
 
   if (strncmp(Command, "device", 6) == 0) {
     // device: prints on the Terminal (using printk) the ADXL345 device ID.
     printk(KERN_INFO "Accelerometer Device ID: %08x\n", DevID);
-    return;
+    return 0;
+  }
+
+  if (strncmp(Command, "mode", 4) == 0) {
+    // mode M: selects what a read returns for this open file:
+    //   text (default) "RR XXXX YYYY ZZZZ SS NNNN TTTT", or binary
+    //   (struct AccelSample).
+    if (strstr(Command + 4, "binary"))
+      File->Mode = ACCEL_MODE_BINARY;
+    else if (strstr(Command + 4, "text"))
+      File->Mode = ACCEL_MODE_TEXT;
+    return 0;
+  }
+
+  if (strncmp(Command, "overflow", 8) == 0) {
+    // overflow P: what to do when the sample ring is full:
+    //   overwrite (default) the oldest sample, or drop the newest sample.
+    if (strstr(Command + 8, "drop"))
+      AccelOverflowPolicy = ACCEL_OVERFLOW_DROP;
+    else if (strstr(Command + 8, "overwrite"))
+      AccelOverflowPolicy = ACCEL_OVERFLOW_OVERWRITE;
+    return 0;
+  }
+
+  if (strncmp(Command, "fifo", 4) == 0) {
+    // fifo stream W: drain the ADXL345 FIFO whenever W (1 - 31) samples
+    //   are waiting (16 if W is not given).
+    // fifo bypass: fetch one sample at a time (default).
+    if (strstr(Command + 4, "stream")) {
+      if (sscanf(Command + 4, "%*[^0123456789]%hhu", &Watermark) < 1)
+        Watermark = 16;
+      if (Watermark < 1 || Watermark > XL345_FIFO_SAMPLES_MASK)
+        return 0;
+      return AccelSetFifo(ACCEL_FIFO_STREAM, Watermark);
+    } else if (strstr(Command + 4, "bypass")) {
+      return AccelSetFifo(ACCEL_FIFO_BYPASS, AccelFifoWatermark);
+    }
+    return 0;
   }
 
   if (strncmp(Command, "calibrate", 9) == 0) {
-    // calibrate: calibrates the device.
-    ADXL345_Calibrate();
-    return;
+    // calibrate N: calibrates the device (in the background) from N samples
+    //   (32 if N is not given).
+    if (sscanf(Command + 9, "%u", &Count) < 1)
+      Count = 0;
+    return AccelStartCalibration(Count);
   }
 
   if (strncmp(Command, "format", 6) == 0) {
@@ -179,11 +1193,10 @@ void InterpCommand(char *Command) {
     //   range G = +/- 2, 4, 8, or 16 g
     if (sscanf(Command + 6, "%*[^0123456789]%hhd %hhd", &Resolution, &Gravity) <
         2)
-      return;
+      return 0;
     if (Resolution > 1)
-      return;
-    ADXL345_SetG(Resolution, Gravity, &MGPerLSB);
-    return;
+      return 0;
+    return ADXL345_SetG(Resolution, Gravity, &MGPerLSB, &AccelFormatReg);
   }
 
   if (strncmp(Command, "rate", 4) == 0) {
@@ -197,106 +1210,282 @@ void InterpCommand(char *Command) {
     //           (i.e., 12.5, 6.25, 3.125 1.563), the user must only specify
     //           the integer value of these: (12 == 12.5, 6 = 6.25, etc.)
     //       (3) We support the frequency range from 3200 hz t0 1.563 hz.
-    if (sscanf(Command + 6, "%*[^0123456789]%hd", &Rate) < 1)
-      return;
-    ADXL345_SetFreq(Rate);
-    return;
+    if (sscanf(Command + 4, "%*[^0123456789]%hd", &Rate) < 1)
+      return 0;
+    return ADXL345_SetFreq(Rate, &AccelRate);
   }
+  return 0;
 }
 
-static int __init init_accel(void) {
-  // This is an early exit strategy for initializtion:
-  int AccelRegisterStatus;
-
-  // 1. Register the Accel Device Driver.
-  AccelRegisterStatus = misc_register(&AccelDev);
-  if (AccelRegisterStatus < 0) {
-    // If the status returned by misc_register is less than 0,
-    // early exit the init... (something has gone wrong).
-    printk(KERN_ERR "/dev/%s: misc_register() failed\n", ACCEL_DEV_NAME);
-    return AccelRegisterStatus;
+// Called once sampling has started: publish the statistics, and calibrate
+// from the first samples (without holding up insmod), unless saved offsets
+// were restored.
+static void AccelSamplingStarted(void) {
+  // The statistics are optional: debugfs may not be available.
+  AccelDebugDir = debugfs_create_dir(ACCEL_DEV_NAME, NULL);
+  if (!IS_ERR_OR_NULL(AccelDebugDir))
+    debugfs_create_file("stats", 0600, AccelDebugDir, NULL, &AccelStatsFops);
+  AccelStarted = true;
+  if (!AccelCalibrated)
+    AccelStartCalibration(0);
+}
+
+// Stop sampling into the ring, however it was started (an interrupt
+// handler may have fallen back to the sampling thread since).
+static void AccelStopSampling(void) {
+  if (AccelIrq >= 0) {
+    AccelFreeIrq();
+    cancel_work_sync(&AccelPollWork);
   }
-  // 2. Log that we've registered the Accelerometer Device driver
-  printk(KERN_INFO "/dev/%s driver registered\n", ACCEL_DEV_NAME);
-  AccelDevRegistered = REGISTERED;
+  if (AccelSamplerTask)
+    kthread_stop(AccelSamplerTask);
+  AccelSamplerTask = NULL;
+}
 
-  // 3. Map SYSMGR into virtual mem.
+static int __init init_accel(void) {
+  int Status;
+
+  // 1. Map SYSMGR into virtual mem.
   SYSMGRVirt = ioremap_nocache(SYSMGR_BASE, SYSMGR_SPAN);
   if (!SYSMGRVirt) {
     printk(KERN_ERR "Error: ioremap_nocache returned NULL\n");
-    AccelDevRegistered = NOT_REGISTERED;
-    misc_deregister(&AccelDev);
+    return -ENOMEM;
   }
 
-  // 4. Map I2C0 into virtual mem.
+  // 2. Map I2C0 into virtual mem.
   I2C0Virt = ioremap_nocache(I2C0_BASE, I2C0_SPAN);
   if (!I2C0Virt) {
     printk(KERN_ERR "Error: ioremap_nocache returned NULL\n");
     iounmap(SYSMGRVirt);
-    AccelDevRegistered = NOT_REGISTERED;
-    misc_deregister(&AccelDev);
+    return -ENOMEM;
   }
 
   // Configure Pin Muxing
   Pinmux_Config();
 
   // Initialize I2C0 Controller
-  I2C0_Init();
-
   // 0xE5 is read from DEVID(0x00) if I2C is functioning correctly
-  ADXL345_REG_READ(ADXL345_REG_DEVID, &DevID);
+  if (I2C0_Init() == 0)
+    ADXL345_REG_READ(ADXL345_REG_DEVID, &DevID);
 
   if (DevID != 0xE5) {
     printk(KERN_ERR "Accelerometer ID is incorrect\n");
-    iounmap(SYSMGRVirt);
-    iounmap(I2C0Virt);
-    AccelDevRegistered = NOT_REGISTERED;
-    misc_deregister(&AccelDev);
+    Status = -ENODEV;
+    goto Unmap;
   }
 
+  // Allocate the sample ring (zeroed, and suitable for mapping to user space)
+  AccelRingMem = vmalloc_user(ACCEL_RING_BYTES);
+  if (!AccelRingMem) {
+    printk(KERN_ERR "Error [%s]: could not allocate the sample ring\n",
+           ACCEL_DEV_NAME);
+    Status = -ENOMEM;
+    goto Unmap;
+  }
+  AccelRingHdr = AccelRingMem;
+  AccelRingHdr->Size = ACCEL_RING_SIZE;
+  AccelRing = AccelRingMem + ACCEL_RING_DATA_OFFSET;
+
   MGPerLSB = ROUNDED_DIVISION(16 * 1000, 512);
-  ADXL345_Init();
-  ADXL345_Calibrate();
-  return AccelRegisterStatus;
+  if (ADXL345_Init()) {
+    printk(KERN_ERR "Error [%s]: could not initialize the ADXL345\n",
+           ACCEL_DEV_NAME);
+    Status = -EIO;
+    goto FreeRing;
+  }
+  mutex_init(&AccelCalFile.Lock);
+  if (AccelHaveSavedOffsets) {
+    Status = AccelRestoreOffsets(&AccelSavedOffsets);
+    if (Status)
+      printk(KERN_WARNING "/dev/%s: could not restore the offsets (%d)\n",
+             ACCEL_DEV_NAME, Status);
+  }
+
+  // Start sampling into the ring buffer: from the ADXL345's interrupt if we
+  // can, by polling otherwise.
+  if (AccelRequestIrq() == 0) {
+    printk(KERN_INFO "/dev/%s: sampling on IRQ %d (ADXL345 INT%d)\n",
+           ACCEL_DEV_NAME, AccelIrq, AccelIntPin);
+    mutex_lock(&AccelBusLock);
+    if (AccelSetInterrupts())
+      printk(KERN_WARNING "/dev/%s: could not enable the ADXL345 interrupts\n",
+             ACCEL_DEV_NAME);
+    mutex_unlock(&AccelBusLock);
+  } else {
+    if (AccelIrqGpio >= 0)
+      printk(KERN_WARNING "/dev/%s: no interrupt for GPIO %d, polling\n",
+             ACCEL_DEV_NAME, AccelIrqGpio);
+    if (AccelSetInterrupts())
+      printk(KERN_WARNING "/dev/%s: could not enable the ADXL345 interrupts\n",
+             ACCEL_DEV_NAME);
+    AccelSamplerTask = kthread_run(AccelSampler, NULL, "%s-sampler",
+                                   ACCEL_DEV_NAME);
+    if (IS_ERR(AccelSamplerTask)) {
+      printk(KERN_ERR "Error [%s]: could not start the sampling thread\n",
+             ACCEL_DEV_NAME);
+      Status = PTR_ERR(AccelSamplerTask);
+      AccelSamplerTask = NULL;
+      goto FreeRing;
+    }
+  }
+
+  // Register the Accel Device Driver last: /dev/accel can be opened (and
+  // read, polled or mapped) as soon as it appears, so the ring and the
+  // sampling must already be in place.
+  Status = misc_register(&AccelDev);
+  if (Status < 0) {
+    printk(KERN_ERR "/dev/%s: misc_register() failed\n", ACCEL_DEV_NAME);
+    goto StopSampling;
+  }
+  printk(KERN_INFO "/dev/%s driver registered\n", ACCEL_DEV_NAME);
+  AccelDevRegistered = REGISTERED;
+  AccelSamplingStarted();
+  return SUCCESS;
+
+StopSampling:
+  AccelStopSampling();
+FreeRing:
+  vfree(AccelRingMem);
+Unmap:
+  iounmap(I2C0Virt);
+  iounmap(SYSMGRVirt);
+  return Status;
 }
 
 static void __exit stop_accel(void) {
   if (AccelDevRegistered) {
+    // Deregister first, so nothing new can open /dev/accel while we tear
+    // down what it uses.
+    misc_deregister(&AccelDev);
+    AccelStarted = false;
+    // Stop any calibration first, while there are samples to wait for.
+    WRITE_ONCE(AccelCalCancel, true);
+    wake_up_interruptible(&AccelReadQueue);
+    cancel_work_sync(&AccelCalWork);
+    debugfs_remove_recursive(AccelDebugDir);
+    AccelStopSampling();
+    vfree(AccelRingMem);
     iounmap(SYSMGRVirt);
     iounmap(I2C0Virt);
-    // Proceed with de-registering the character driver
-    misc_deregister(&AccelDev);
     printk(KERN_INFO "/dev/%s driver de-registered\n", ACCEL_DEV_NAME);
   }
 }
 
 /* Called when a process opens /dev/accel */
 static int AccelDevOpen(struct inode *inode, struct file *file) {
+  struct AccelFile *File = kzalloc(sizeof(*File), GFP_KERNEL);
+  unsigned long Flags;
+
+  if (!File)
+    return -ENOMEM;
+  // Every open file starts out in text mode, and only sees samples and
+  // events from now on.
+  // /dev/accel is a stream: no lseek or pread/pwrite (the text mode offset
+  // only moves through a sample's line).
+  nonseekable_open(inode, file);
+  mutex_init(&File->Lock);
+  File->Mode = ACCEL_MODE_TEXT;
+  strcpy(File->ReadBuf, "-- No Data Ready. --");
+  File->RingTail = smp_load_acquire(&AccelRingHdr->Head);
+  spin_lock_irqsave(&AccelEventLock, Flags);
+  File->EventTail = AccelEventHead;
+  spin_unlock_irqrestore(&AccelEventLock, Flags);
+
+  spin_lock(&AccelFilesLock);
+  list_add_tail(&File->Node, &AccelFiles);
+  spin_unlock(&AccelFilesLock);
+  file->private_data = File;
   return SUCCESS;
 }
 
 /* Called when a process closes /dev/accel */
-static int AccelDevRelease(struct inode *inode, struct file *file) { return 0; }
+static int AccelDevRelease(struct inode *inode, struct file *file) {
+  struct AccelFile *File = file->private_data;
+
+  spin_lock(&AccelFilesLock);
+  list_del(&File->Node);
+  spin_unlock(&AccelFilesLock);
+  kfree(File);
+  return 0;
+}
 
 static ssize_t AccelDevRead(struct file *FilP, char *Buffer, size_t Length,
                             loff_t *Offset) {
 
+  struct AccelFile *File = FilP->private_data;
   // Bytes to Sendout.
   size_t BytesToSend;
+  size_t LineLength;
+  ssize_t Status;
+  struct AccelSample Sample;
+  bool Popped = false;
+
+  AccelStatAdd(ACCEL_STAT_READS, 1);
+  // From its first read on, this file holds back the producer in drop mode.
+  WRITE_ONCE(File->Reading, true);
+
+  // At the start of a read, wait for the sampling thread to produce a
+  // sample (unless the file was opened with O_NONBLOCK).
+  if (File->Mode == ACCEL_MODE_BINARY || !(*Offset)) {
+    while (!AccelRingHasData(File)) {
+      if (FilP->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+      if (wait_event_interruptible(AccelReadQueue, AccelRingHasData(File)))
+        return -ERESTARTSYS;
+    }
+  }
 
+  mutex_lock(&File->Lock);
+  // In binary mode a read drains as many whole samples from the ring
+  // as fit in the user's buffer. There is no end-of-file and the offset
+  // is not used.
+  if (File->Mode == ACCEL_MODE_BINARY) {
+    if (Length < sizeof(struct AccelSample))
+      Status = -EINVAL;
+    else
+      Status = AccelRingRead(File, Buffer, Length / sizeof(struct AccelSample));
+    mutex_unlock(&File->Lock);
+    if (Status > 0)
+      AccelStatAdd(ACCEL_STAT_READ_BYTES, Status);
+    return Status;
+  }
+
+  // In text mode, a read at offset 0 takes this file's next sample from the
+  // ring. The events in SS are this file's own unread events, so each
+  // reader sees every tap once.
   if (!(*Offset)) {
-    AccelDataToStr();
+    Popped = AccelRingPop(File, &Sample);
+    if (!Popped) {
+      Sample = LastSample;
+      Sample.Status = 0;
+    }
+    Sample.Status &= ~ACCEL_EVENTS;
+    Sample.Status |= AccelTakeEventFlags(File);
+    AccelDataToStr(File, &Sample);
   }
 
   // 1. Determine How many bytes to Send:
-  //    (a) Find How many Outstanding bytes there are
-  BytesToSend = strlen(ACCEL_READ_BUF) - (*Offset);
+  //    (a) Find How many Outstanding bytes there are (the offset only ever
+  //        comes from our own reads, but don't trust it).
+  LineLength = strlen(File->ReadBuf);
+  if (*Offset < 0 || (size_t)*Offset > LineLength) {
+    mutex_unlock(&File->Lock);
+    return -EINVAL;
+  }
+  BytesToSend = LineLength - (*Offset);
   //    (b) Send the Maximum number of bytes user space can handle.
   BytesToSend = BytesToSend > Length ? Length : BytesToSend;
   // 3. Send out bytes to user space.
   if (BytesToSend > 0) {
-    if (copy_to_user(Buffer, &ACCEL_READ_BUF[*Offset], BytesToSend) != 0)
-      printk(KERN_ERR "Error [%s]: copy_to_user unsuccessful", ACCEL_DEV_NAME);
+    if (copy_to_user(Buffer, &File->ReadBuf[*Offset], BytesToSend) != 0) {
+      mutex_unlock(&File->Lock);
+      return -EFAULT;
+    }
+    if (Popped) {
+      trace_accel_deliver(Sample.Seq, Sample.Timestamp, 1);
+      AccelHistAdd(AccelCopyHist, ktime_get_ns() - Sample.Timestamp);
+    }
+    AccelStatAdd(ACCEL_STAT_READ_BYTES, BytesToSend);
     // Update the File Ptr's Offset to reflect where to read from next read.
     *Offset += BytesToSend;
   }
@@ -304,28 +1493,230 @@ static ssize_t AccelDevRead(struct file *FilP, char *Buffer, size_t Length,
   //    This allows the next read to "read" from the beginning of the file.
   if (BytesToSend == 0)
     *Offset = 0;
+  mutex_unlock(&File->Lock);
   return BytesToSend;
 }
 
+// Fill in the current configuration for ACCEL_IOC_GET_CONFIG.
+static void AccelGetConfig(struct file *FilP, struct AccelConfig *Config) {
+  struct AccelFile *File = FilP->private_data;
+
+  memset(Config, 0, sizeof(*Config));
+  Config->RateMilliHz = XL345_RATE_MILLIHZ(AccelRate);
+  Config->Format.Range = 2 << (AccelFormatReg & XL345_RANGE_16G);
+  Config->Format.FullRes = !!(AccelFormatReg & XL345_FULL_RESOLUTION);
+  Config->Format.Scale = MGPerLSB;
+  Config->Mode = File->Mode;
+  Config->OverflowPolicy = AccelOverflowPolicy;
+  Config->Fifo.Mode = AccelFifoMode;
+  Config->Fifo.Watermark = AccelFifoWatermark;
+  Config->Thresholds = AccelThresh;
+}
+
+// Typed control interface (see accel_uapi.h). Set requests are validated,
+// applied, and the effective value is copied back to user space.
+static long AccelDevIoctl(struct file *FilP, unsigned int Cmd,
+                          unsigned long Arg) {
+  struct AccelFile *File = FilP->private_data;
+  void *UserArg = (void *)Arg;
+  uint32_t RateMilliHz;
+  uint32_t ID;
+  uint8_t Rate;
+  struct AccelFormat Format;
+  struct AccelThresholds Thresh;
+  struct AccelFifo Fifo;
+  struct AccelConfig Config;
+  struct AccelOffsets Offsets;
+  struct AccelEventRead EventRead;
+  struct AccelEvent Events[16];
+  unsigned int Count;
+  unsigned long Flags;
+  int Status;
+
+  switch (Cmd) {
+  case ACCEL_IOC_SET_RATE:
+    if (copy_from_user(&RateMilliHz, UserArg, sizeof(RateMilliHz)))
+      return -EFAULT;
+    if (RateMilliHz == 0 ||
+        RateMilliHz > XL345_RATE_MILLIHZ(XL345_RATE_3200))
+      return -EINVAL;
+    // Find the highest rate which does not exceed the request.
+    Rate = XL345_RATE_3200;
+    while (Rate > XL345_RATE__098 && XL345_RATE_MILLIHZ(Rate) > RateMilliHz)
+      Rate--;
+    mutex_lock(&AccelBusLock);
+    Status = ADXL345_SetRate(Rate);
+    if (!Status)
+      AccelRate = Rate;
+    mutex_unlock(&AccelBusLock);
+    if (Status)
+      return Status;
+    RateMilliHz = XL345_RATE_MILLIHZ(Rate);
+    return copy_to_user(UserArg, &RateMilliHz, sizeof(RateMilliHz)) ? -EFAULT
+                                                                     : 0;
+
+  case ACCEL_IOC_SET_FORMAT:
+    if (copy_from_user(&Format, UserArg, sizeof(Format)))
+      return -EFAULT;
+    if (Format.FullRes > 1 || (Format.Range != 2 && Format.Range != 4 &&
+                               Format.Range != 8 && Format.Range != 16))
+      return -EINVAL;
+    mutex_lock(&AccelBusLock);
+    Status = ADXL345_SetG(Format.FullRes, Format.Range, &MGPerLSB,
+                          &AccelFormatReg);
+    Format.Scale = MGPerLSB;
+    mutex_unlock(&AccelBusLock);
+    if (Status)
+      return Status;
+    return copy_to_user(UserArg, &Format, sizeof(Format)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_CALIBRATE:
+    if (Arg > ACCEL_CALIBRATE_MAX)
+      return -EINVAL;
+    return AccelStartCalibration(Arg);
+
+  case ACCEL_IOC_GET_DEVID:
+    ID = DevID;
+    return copy_to_user(UserArg, &ID, sizeof(ID)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_SET_THRESHOLDS:
+    if (copy_from_user(&Thresh, UserArg, sizeof(Thresh)))
+      return -EFAULT;
+    // A threshold of 0 makes the ADXL345 report events constantly.
+    if (!Thresh.ThreshTap || !Thresh.ThreshAct || !Thresh.ThreshInact ||
+        Thresh.TapAxes > 0x0F)
+      return -EINVAL;
+    memset(Thresh.Reserved, 0, sizeof(Thresh.Reserved));
+    mutex_lock(&AccelBusLock);
+    Status = ADXL345_SetTap(Thresh.ThreshTap, Thresh.Dur, Thresh.Latent,
+                            Thresh.Window, Thresh.TapAxes);
+    if (!Status)
+      Status = ADXL345_SetActivity(Thresh.ThreshAct, Thresh.ThreshInact,
+                                   Thresh.TimeInact, Thresh.ActInactCtl);
+    if (!Status)
+      AccelThresh = Thresh;
+    mutex_unlock(&AccelBusLock);
+    if (Status)
+      return Status;
+    return copy_to_user(UserArg, &Thresh, sizeof(Thresh)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_SET_FIFO:
+    if (copy_from_user(&Fifo, UserArg, sizeof(Fifo)))
+      return -EFAULT;
+    if (Fifo.Mode > ACCEL_FIFO_STREAM || Fifo.Watermark < 1 ||
+        Fifo.Watermark > XL345_FIFO_SAMPLES_MASK)
+      return -EINVAL;
+    mutex_lock(&AccelBusLock);
+    Status = AccelSetFifo(Fifo.Mode, Fifo.Watermark);
+    mutex_unlock(&AccelBusLock);
+    if (Status)
+      return Status;
+    return copy_to_user(UserArg, &Fifo, sizeof(Fifo)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_READ_EVENTS:
+    if (copy_from_user(&EventRead, UserArg, sizeof(EventRead)))
+      return -EFAULT;
+    // Copy the events out in small batches (they can't be copied to user
+    // space while the event queue is locked).
+    EventRead.Count = 0;
+    while (EventRead.Count < EventRead.Max) {
+      Count = AccelTakeEvents(File, Events,
+                              min_t(unsigned int,
+                                    EventRead.Max - EventRead.Count,
+                                    ARRAY_SIZE(Events)));
+      if (!Count)
+        break;
+      if (copy_to_user((struct AccelEvent *)(unsigned long)EventRead.Events +
+                           EventRead.Count,
+                       Events, Count * sizeof(struct AccelEvent)))
+        return -EFAULT;
+      EventRead.Count += Count;
+    }
+    spin_lock_irqsave(&AccelEventLock, Flags);
+    EventRead.Lost = File->EventsLost;
+    File->EventsLost = 0;
+    spin_unlock_irqrestore(&AccelEventLock, Flags);
+    EventRead.Reserved = 0;
+    return copy_to_user(UserArg, &EventRead, sizeof(EventRead)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_GET_OFFSETS:
+    mutex_lock(&AccelBusLock);
+    Status = AccelGetOffsets(&Offsets);
+    mutex_unlock(&AccelBusLock);
+    if (Status)
+      return Status;
+    return copy_to_user(UserArg, &Offsets, sizeof(Offsets)) ? -EFAULT : 0;
+
+  case ACCEL_IOC_SET_OFFSETS:
+    if (copy_from_user(&Offsets, UserArg, sizeof(Offsets)))
+      return -EFAULT;
+    mutex_lock(&AccelBusLock);
+    Status = AccelRestoreOffsets(&Offsets);
+    mutex_unlock(&AccelBusLock);
+    return Status;
+
+  case ACCEL_IOC_GET_CONFIG:
+    mutex_lock(&AccelBusLock);
+    AccelGetConfig(FilP, &Config);
+    mutex_unlock(&AccelBusLock);
+    return copy_to_user(UserArg, &Config, sizeof(Config)) ? -EFAULT : 0;
+  }
+  return -ENOTTY;
+}
+
+// Report /dev/accel as readable once a sample is waiting, and POLLPRI while
+// the file has unread events. Commands can always be written.
+static unsigned int AccelDevPoll(struct file *FilP, poll_table *Wait) {
+  unsigned int Mask = POLLOUT | POLLWRNORM;
+
+  poll_wait(FilP, &AccelReadQueue, Wait);
+  if (AccelRingHasData(FilP->private_data))
+    Mask |= POLLIN | POLLRDNORM;
+  if (AccelFileHasEvents(FilP->private_data))
+    Mask |= POLLPRI;
+  return Mask;
+}
+
+// Map the sample ring (read only) into user space. Consumers can then read
+// samples straight from the shared pages, without a system call or copy per
+// sample (see struct AccelRingHeader in accel_uapi.h).
+static int AccelDevMmap(struct file *FilP, struct vm_area_struct *Vma) {
+  if (Vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  Vma->vm_flags &= ~VM_MAYWRITE;
+  return remap_vmalloc_range(Vma, AccelRingMem, Vma->vm_pgoff);
+}
+
 static ssize_t AccelDevWrite(struct file *FilP, const char *Buffer,
                              size_t Length, loff_t *Offset) {
+  struct AccelFile *File = FilP->private_data;
   // 1. Store the Length of the Message that user has written to us.
   size_t BytesRead = Length;
+  int Status;
 
   // 2. Can we copy the entire message at once (is our buffer large enough)
   if (BytesRead > ACCEL_WRITE_BUF_SIZE - 1)
     BytesRead = ACCEL_WRITE_BUF_SIZE - 1;
 
-  // 3. Copy the data from user space here, to our buffer.
-  if (copy_from_user(ACCEL_WRITE_BUF, Buffer, BytesRead)) {
+  // 3. Copy the data from user space here, to this file's buffer.
+  mutex_lock(&File->Lock);
+  if (copy_from_user(File->WriteBuf, Buffer, BytesRead)) {
+    mutex_unlock(&File->Lock);
     printk(KERN_ERR "Error [%s]: Couldn't copy all bytes via copy_from_user",
            ACCEL_DEV_NAME);
     return -EFAULT;
   }
 
-  ACCEL_WRITE_BUF[BytesRead] = '\0'; // NULL terminate
-  // Process the command.
-  InterpCommand(ACCEL_WRITE_BUF);
+  File->WriteBuf[BytesRead] = '\0'; // NULL terminate
+  // Process the command (commands may talk to the ADXL345, so the
+  // sampling thread must be kept off the bus).
+  mutex_lock(&AccelBusLock);
+  Status = InterpCommand(FilP, File->WriteBuf);
+  mutex_unlock(&AccelBusLock);
+  trace_accel_command(File->WriteBuf, Status);
+  mutex_unlock(&File->Lock);
+  if (Status)
+    return Status;
   // Notes:
   // 1. We do NOT update *offset (although, it could be done)
   // 2. We return Length (to fake-out the write operation). That is
@@ -0,0 +1,108 @@
+// Tracepoints for the accel driver (tracing/events/accel in debugfs).
+// They cost (almost) nothing while disabled, and can be recorded alongside
+// scheduler events (e.g., `perf record -e 'accel:*' -e 'sched:*'`) to see
+// where the time between the ADXL345 and a reader goes.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM accel
+
+#if !defined(__ACCEL_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __ACCEL_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+// An I2C transfer to/from the ADXL345 register at Address is started
+// (Bytes is the number of bytes on the wire, including addresses).
+TRACE_EVENT(accel_i2c_start,
+            TP_PROTO(bool Read, uint8_t Address, unsigned int Bytes),
+            TP_ARGS(Read, Address, Bytes),
+            TP_STRUCT__entry(__field(bool, Read) __field(uint8_t, Address)
+                                 __field(unsigned int, Bytes)),
+            TP_fast_assign(__entry->Read = Read; __entry->Address = Address;
+                           __entry->Bytes = Bytes;),
+            TP_printk("%s reg=0x%02x bytes=%u",
+                      __entry->Read ? "read" : "write", __entry->Address,
+                      __entry->Bytes));
+
+// The transfer completed (Status 0) or failed, after DurationNs.
+TRACE_EVENT(accel_i2c_done,
+            TP_PROTO(bool Read, uint8_t Address, unsigned int Bytes,
+                     uint64_t DurationNs, int Status),
+            TP_ARGS(Read, Address, Bytes, DurationNs, Status),
+            TP_STRUCT__entry(__field(bool, Read) __field(uint8_t, Address)
+                                 __field(unsigned int, Bytes)
+                                     __field(uint64_t, DurationNs)
+                                         __field(int, Status)),
+            TP_fast_assign(__entry->Read = Read; __entry->Address = Address;
+                           __entry->Bytes = Bytes;
+                           __entry->DurationNs = DurationNs;
+                           __entry->Status = Status;),
+            TP_printk("%s reg=0x%02x bytes=%u duration=%llu ns status=%d",
+                      __entry->Read ? "read" : "write", __entry->Address,
+                      __entry->Bytes, __entry->DurationNs, __entry->Status));
+
+// A sample was pushed into the ring.
+TRACE_EVENT(accel_sample,
+            TP_PROTO(const struct AccelSample *Sample),
+            TP_ARGS(Sample),
+            TP_STRUCT__entry(__field(uint64_t, Timestamp) __field(uint32_t, Seq)
+                                 __field(int16_t, X) __field(int16_t, Y)
+                                     __field(int16_t, Z)
+                                         __field(uint8_t, Status)),
+            TP_fast_assign(__entry->Timestamp = Sample->Timestamp;
+                           __entry->Seq = Sample->Seq;
+                           __entry->X = Sample->X; __entry->Y = Sample->Y;
+                           __entry->Z = Sample->Z;
+                           __entry->Status = Sample->Status;),
+            TP_printk("seq=%u timestamp=%llu x=%d y=%d z=%d status=0x%02x",
+                      __entry->Seq, __entry->Timestamp, __entry->X,
+                      __entry->Y, __entry->Z, __entry->Status));
+
+// Count samples (the newest of which is Seq, acquired at Timestamp) were
+// copied to a reader.
+TRACE_EVENT(accel_deliver,
+            TP_PROTO(uint32_t Seq, uint64_t Timestamp, unsigned int Count),
+            TP_ARGS(Seq, Timestamp, Count),
+            TP_STRUCT__entry(__field(uint32_t, Seq) __field(uint64_t, Timestamp)
+                                 __field(unsigned int, Count)),
+            TP_fast_assign(__entry->Seq = Seq; __entry->Timestamp = Timestamp;
+                           __entry->Count = Count;),
+            TP_printk("seq=%u timestamp=%llu count=%u", __entry->Seq,
+                      __entry->Timestamp, __entry->Count));
+
+// A command written to /dev/accel was executed (Status 0) or failed.
+TRACE_EVENT(accel_command,
+            TP_PROTO(const char *Command, int Status),
+            TP_ARGS(Command, Status),
+            TP_STRUCT__entry(__array(char, Command, 32) __field(int, Status)),
+            TP_fast_assign(strlcpy(__entry->Command, Command,
+                                   sizeof(__entry->Command));
+                           __entry->Status = Status;),
+            TP_printk("\"%s\" status=%d", __entry->Command, __entry->Status));
+
+// Calibration phases.
+#define ACCEL_CAL_START 0    // Waiting for Count samples
+#define ACCEL_CAL_AVERAGED 1 // Count samples were collected and averaged
+#define ACCEL_CAL_DONE 2     // The offsets were corrected (Status 0) or not
+
+TRACE_EVENT(accel_calibrate,
+            TP_PROTO(int Phase, unsigned int Count, int Status),
+            TP_ARGS(Phase, Count, Status),
+            TP_STRUCT__entry(__field(int, Phase) __field(unsigned int, Count)
+                                 __field(int, Status)),
+            TP_fast_assign(__entry->Phase = Phase; __entry->Count = Count;
+                           __entry->Status = Status;),
+            TP_printk("%s count=%u status=%d",
+                      __print_symbolic(__entry->Phase,
+                                       {ACCEL_CAL_START, "start"},
+                                       {ACCEL_CAL_AVERAGED, "averaged"},
+                                       {ACCEL_CAL_DONE, "done"}),
+                      __entry->Count, __entry->Status));
+
+#endif /* __ACCEL_TRACE_H__ */
+
+// This part must be outside the include guard.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE accel_trace
+#include <trace/define_trace.h>
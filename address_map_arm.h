@@ -48,8 +48,13 @@
 #define I2C0_DATA_CMD          0x00000004      // word offset
 #define I2C0_FS_SCL_HCNT       0x00000007      // word offset
 #define I2C0_FS_SCL_LCNT       0x00000008      // word offset
+#define I2C0_RAW_INTR_STAT     0x0000000D      // word offset
+#define I2C0_CLR_TX_ABRT       0x00000015      // word offset
 #define I2C0_ENABLE            0x0000001B      // word offset
+#define I2C0_STATUS            0x0000001C      // word offset
+#define I2C0_TXFLR             0x0000001D      // word offset
 #define I2C0_RXFLR             0x0000001E      // word offset
+#define I2C0_TX_ABRT_SOURCE    0x00000020      // word offset
 #define I2C0_ENABLE_STATUS     0x00000027      // word offset
 #define I2C0_SPAN              0x00000100      // span
 
@@ -0,0 +1,575 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "address_map_arm.h"
+
+// Count the I2C transfers of the simulated device the same way the driver
+// does for /sys/kernel/debug/accel/stats (i2c_xfers).
+static long SimXfers;
+#define ADXL345_XFER_DONE(Read, Address, Bytes, StartNs, Status)              \
+  ((void)(StartNs), SimXfers++)
+
+#include "ADXL345.h"
+#include "benchutils.h"
+#include "driverutils.h"
+#include "pipeline.h"
+#include "plotutils.h"
+
+// End-to-end benchmark of sampling and rendering. Reports:
+//  read_text, read_binary, read_batched: samples/s and CPU per sample of
+//    reading /dev/accel in text mode (read until EOF, then sscanf), in
+//    binary mode one sample per read, and in binary mode 64 samples per
+//    read; with the I2C transfers per sample, from the driver's statistics.
+//  sim_text, sim_binary, sim_batched: instead of the read_* results,
+//    without /dev/accel (see below).
+//  parse_sscanf: parsing one text sample (ParseSample in driverutils.h).
+//  format_datatostr: formatting one text sample (AccelDataToStr's format).
+//  plot_frame: frames/s and bytes written per frame of a part3 style frame
+//    (plotutils.h), on an 80x24 terminal; plot_frame_percell sends each
+//    changed cell with its own color, position and reset (ENCODE_PER_CELL),
+//    for comparison.
+//  queue_spsc: samples/s through the acquisition queue of part3 and part4
+//    (pipeline.h), from a producer thread pushing batches of 64 to a consumer
+//    popping them.
+//
+// Without /dev/accel (or with -s), the read path runs against the ADXL345
+// simulator (sim/ADXL345Sim.h, on its virtual clock) through the shared
+// ADXL345 core, acquiring samples like the driver's sampling thread:
+// sim_text and sim_binary poll in bypass mode, sim_batched drains the FIFO
+// in stream mode. sim_text then formats and parses each sample in user
+// space; it doesn't go through the driver's text path. As only waiting is
+// simulated, these have no meaningful rate: they report the CPU per sample
+// (which includes the simulator, but no system calls) and the I2C transfers
+// per sample.
+//
+// Results are written as JSON (to accelbench.json by default) so runs can be
+// compared across builds, and summarized on stderr.
+//
+// Usage: ./accelbench.exe [-s] [-d seconds per benchmark] [-o report.json]
+
+#define BATCH_SIZE 64
+#define SIM_WATERMARK 16
+#define TEXT_FORMAT "%02x %04d %04d %04d %02d %u %llu\n"
+#define STATS_PATH "/sys/kernel/debug/accel/stats"
+
+volatile sig_atomic_t Running = 1;
+
+void IntHandler(int inter) { Running = 0; }
+
+volatile unsigned int *SYSMGRVirt;
+volatile unsigned int *I2C0Virt;
+
+struct BenchResult {
+  const char *Name;
+  const char *Unit; // What one operation is (sample, parse, frame, ...)
+  long Ops;
+  double WallTime;      // s
+  double CPUTime;       // s (user + system)
+  double XfersPerOp;    // I2C transfers per operation (< 0: unknown)
+  double BytesPerOp;    // Bytes written per operation (< 0: not measured)
+  bool Simulated;       // On the simulator's clock: no rate, only costs
+};
+
+#define NUM_RESULTS 8
+struct BenchResult Results[NUM_RESULTS];
+int NumResults;
+
+struct BenchResult *NewResult(const char *Name, const char *Unit) {
+  struct BenchResult *Result = &Results[NumResults++];
+  Result->Name = Name;
+  Result->Unit = Unit;
+  Result->XfersPerOp = -1;
+  Result->BytesPerOp = -1;
+  Result->Simulated = false;
+  return Result;
+}
+
+/* BEGIN Device Read Path */
+
+// The driver's statistics are only readable as root, with debugfs mounted.
+// Returns the named counter, or -1.
+long ReadStat(const char *Name) {
+  char Line[64];
+  char Field[32];
+  long Value = -1;
+  long Parsed;
+  FILE *Stats = fopen(STATS_PATH, "r");
+
+  if (!Stats)
+    return -1;
+  while (fgets(Line, sizeof(Line), Stats)) {
+    if (sscanf(Line, "%31[^:]: %ld", Field, &Parsed) == 2 &&
+        strcmp(Field, Name) == 0)
+      Value = Parsed;
+  }
+  fclose(Stats);
+  return Value;
+}
+
+void ResetStats() {
+  FILE *Stats = fopen(STATS_PATH, "w");
+  if (Stats) {
+    fputs("0", Stats);
+    fclose(Stats);
+  }
+}
+
+// Read /dev/accel for Duration seconds: in text mode if Batch is 0,
+// otherwise in binary mode, Batch samples per read.
+void BenchDevice(double Duration, int Batch, struct BenchResult *Result) {
+  struct AccelSample Samples[BATCH_SIZE];
+  double Start;
+  double CPUStart;
+  long Xfers;
+  long Produced;
+  int i;
+
+  if (Batch)
+    WriteTo(ACCEL, "mode binary", 11);
+  else
+    WriteTo(ACCEL, "mode text", 9);
+  ResetStats();
+
+  Start = Now();
+  CPUStart = CPUNow();
+  while (Running && Now() - Start < Duration) {
+    if (!Batch) {
+      ReadFrom(ACCEL, AccelReadBuffer, ACCEL_READ_SIZE);
+      if (ParseSample(AccelReadBuffer, Samples) &&
+          (Samples[0].Status & ACCEL_DATAREADY))
+        Result->Ops++;
+    } else {
+      i = ReadSamplesFrom(ACCEL, Samples, Batch);
+      while (i--)
+        Result->Ops += (Samples[i].Status & ACCEL_DATAREADY) != 0;
+    }
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+
+  // The driver samples independently of its readers, so this is the
+  // acquisition's cost per sample produced.
+  Xfers = ReadStat("i2c_xfers");
+  Produced = ReadStat("samples");
+  if (Xfers >= 0 && Produced > 0)
+    Result->XfersPerOp = (double)Xfers / Produced;
+}
+
+/* END Device Read Path */
+
+/* BEGIN Simulated Read Path */
+
+struct AccelSample SimLast;
+int16_t SimScale;
+
+// Fetch the new samples like the driver's sampling thread (see
+// AccelAcquireSamples in accelmod/accel.c): the same ADXL345_DrainFifo, and
+// FIFO samples timestamped one output data period apart, backwards from
+// the newest one.
+// Returns the number of samples put in Samples.
+int SimAcquire(bool Stream, struct AccelSample *Samples) {
+  int16_t XYZ[ADXL345_DRAIN_MAX][3];
+  uint8_t IntSource;
+  uint64_t Now = ADXL345_NOW_NS();
+  uint64_t PeriodNs = XL345_RATE_PERIOD_US(XL345_RATE_3200) * 1000ULL;
+  int Count;
+  int Error;
+  int i;
+
+  Count = ADXL345_DrainFifo(XYZ, ADXL345_DRAIN_MAX, Stream, &IntSource, &Error);
+  for (i = 0; i < Count; ++i) {
+    SimLast.X = XYZ[i][0];
+    SimLast.Y = XYZ[i][1];
+    SimLast.Z = XYZ[i][2];
+    SimLast.Seq++;
+    SimLast.Timestamp = Now - (Count - 1 - i) * PeriodNs;
+    SimLast.Status = XL345_DATAREADY;
+    SimLast.Scale = SimScale;
+    Samples[i] = SimLast;
+  }
+  return Count > 0 ? Count : 0;
+}
+
+// Set up the simulated board: 3200 Hz, FIFO in bypass mode.
+void SimSetup() {
+  uint8_t Format;
+
+  // Only the time spent waiting is simulated, so runs are repeatable.
+  setenv("ADXL345_SIM_CLOCK", "virtual", 0);
+  SYSMGRVirt = map_physical(0, SYSMGR_BASE, SYSMGR_SPAN);
+  I2C0Virt = map_physical(0, I2C0_BASE, I2C0_SPAN);
+  Pinmux_Config();
+  if (I2C0_Init() || ADXL345_Init() || ADXL345_SetRate(XL345_RATE_3200) ||
+      ADXL345_SetG(false, 16, &SimScale, &Format)) {
+    fprintf(stderr, "The simulated ADXL345 could not be set up.\n");
+    exit(-1);
+  }
+}
+
+// Acquire from the simulator for Duration seconds of host time (its sleeps
+// take none), and hand each sample over as text (formatted, then parsed) if
+// Batch is 0, or as binary. Batch > 1 drains the FIFO in stream mode.
+void BenchSim(double Duration, int Batch, struct BenchResult *Result) {
+  struct AccelSample Samples[ADXL345_DRAIN_MAX];
+  struct AccelSample Copy[ADXL345_DRAIN_MAX];
+  char Line[ACCEL_READ_SIZE];
+  bool Stream = Batch > 1;
+  unsigned int PeriodUs = XL345_RATE_PERIOD_US(XL345_RATE_3200);
+  long Xfers;
+  double Start;
+  double CPUStart;
+  int Count;
+  int i;
+
+  ADXL345_SetFifo(Stream ? XL345_FIFO_MODE_STREAM : XL345_FIFO_MODE_BYPASS,
+                  SIM_WATERMARK);
+  if (Stream)
+    PeriodUs *= SIM_WATERMARK;
+
+  Result->Simulated = true;
+  Xfers = SimXfers;
+  Start = Now();
+  CPUStart = CPUNow();
+  while (Running && Now() - Start < Duration) {
+    Count = SimAcquire(Stream, Samples);
+    if (!Batch) {
+      for (i = 0; i < Count; ++i) {
+        snprintf(Line, sizeof(Line), TEXT_FORMAT, Samples[i].Status,
+                 Samples[i].X, Samples[i].Y, Samples[i].Z, Samples[i].Scale,
+                 Samples[i].Seq, (unsigned long long)Samples[i].Timestamp);
+        Result->Ops += ParseSample(Line, &Copy[i]);
+      }
+    } else {
+      memcpy(Copy, Samples, Count * sizeof(struct AccelSample));
+      Result->Ops += Count;
+    }
+    // The sampling thread polls at twice the rate it expects data.
+    ADXL345_SLEEP_US(PeriodUs / 2, PeriodUs / 2 + PeriodUs / 8);
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+  if (Result->Ops)
+    Result->XfersPerOp = (double)(SimXfers - Xfers) / Result->Ops;
+}
+
+/* END Simulated Read Path */
+
+/* BEGIN Text Format */
+
+// Format text samples (as the driver's AccelDataToStr does).
+void BenchFormat(double Duration, struct BenchResult *Result) {
+  char Line[ACCEL_READ_SIZE];
+  double Start = Now();
+  double CPUStart = CPUNow();
+  int i;
+
+  while (Running && Now() - Start < Duration) {
+    for (i = 0; i < 1000; ++i)
+      snprintf(Line, sizeof(Line), TEXT_FORMAT, XL345_DATAREADY,
+               (i & 511) - 256, 256 - (i & 255), i & 1023, 31, i,
+               1000000000ULL + i * 312500ULL);
+    Result->Ops += i;
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+}
+
+// Parse text samples (with ParseSample).
+void BenchParse(double Duration, struct BenchResult *Result) {
+  char Lines[256][ACCEL_READ_SIZE];
+  struct AccelSample Sample;
+  double Start;
+  double CPUStart;
+  int i;
+
+  for (i = 0; i < 256; ++i)
+    snprintf(Lines[i], sizeof(Lines[i]), TEXT_FORMAT, XL345_DATAREADY,
+             i - 128, 128 - i, i * 4, 31, i, 1000000000ULL + i * 312500ULL);
+
+  Start = Now();
+  CPUStart = CPUNow();
+  while (Running && Now() - Start < Duration) {
+    for (i = 0; i < 1000; ++i)
+      ParseSample(Lines[i & 255], &Sample);
+    Result->Ops += i;
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+}
+
+/* END Text Format */
+
+/* BEGIN Rendering */
+
+// One frame of part3: erase the previous circle, print the sample, and draw
+// the circle at its new position.
+void DrawFrame(long Frame) {
+  char OutputString[50];
+  int16_t X = (Frame % 40) - 20;
+  int16_t Y = ((Frame / 3) % 16) - 8;
+  int i;
+
+  if (Main.Valid)
+    ClearCircle(Main.X, Main.Y, Main.R);
+  snprintf(OutputString, 50, "X=%4d Y=%4d Z=%4d (milli m/s^2)\n", X * 31,
+           Y * 31, 992);
+  for (i = 0; i < strlen(OutputString) - 1; ++i)
+    PlotChar(i + 1, 3, GREEN, OutputString[i]);
+  Main.X = X + (XRange >> 1);
+  Main.Y = Y + (YRange >> 1);
+  Main.R = 4;
+  Main.Valid = 1;
+  PlotCircle(Main.X, Main.Y, Main.R, RED);
+  PresentFrame();
+}
+
+// Render frames for Duration seconds, with stdout redirected to a temporary
+// file (to count the bytes written, without a terminal's cost).
+void BenchPlot(double Duration, int Encoding, struct BenchResult *Result) {
+  FILE *Sink = tmpfile();
+  int Saved = dup(STDOUT_FILENO);
+  long Bytes = 0;
+  double Start;
+  double CPUStart;
+
+  if (!Sink || Saved == -1) {
+    fprintf(stderr, "Could not redirect stdout.\n");
+    return;
+  }
+  fflush(stdout);
+  dup2(fileno(Sink), STDOUT_FILENO);
+
+  FrameEncoding = Encoding;
+  InitializeTerminal();
+  XRange = 80;
+  YRange = 24;
+  fflush(stdout);
+  lseek(STDOUT_FILENO, 0, SEEK_SET);
+  ftruncate(STDOUT_FILENO, 0);
+
+  Start = Now();
+  CPUStart = CPUNow();
+  while (Running && Now() - Start < Duration) {
+    DrawFrame(Result->Ops++);
+    // Keep the file small: only its size is of interest.
+    if (!(Result->Ops & 1023)) {
+      fflush(stdout);
+      Bytes += lseek(STDOUT_FILENO, 0, SEEK_CUR);
+      lseek(STDOUT_FILENO, 0, SEEK_SET);
+      ftruncate(STDOUT_FILENO, 0);
+    }
+  }
+  fflush(stdout);
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+  Bytes += lseek(STDOUT_FILENO, 0, SEEK_CUR);
+  if (Result->Ops)
+    Result->BytesPerOp = (double)Bytes / Result->Ops;
+
+  dup2(Saved, STDOUT_FILENO);
+  close(Saved);
+  fclose(Sink);
+}
+
+/* END Rendering */
+
+/* BEGIN Acquisition Queue */
+
+static struct SampleQueue Queue;
+static int QueueDone;
+
+// Push batches of samples into the queue until told to stop (retrying the
+// ones which didn't fit, so nothing is lost).
+void *QueueProducer(void *Arg) {
+  struct AccelSample Samples[PIPELINE_BATCH];
+  uint32_t Seq = 0;
+  int Pushed;
+  int i;
+
+  memset(Samples, 0, sizeof(Samples));
+  while (!__atomic_load_n(&QueueDone, __ATOMIC_ACQUIRE)) {
+    for (i = 0; i < PIPELINE_BATCH; ++i)
+      Samples[i].Seq = Seq + i;
+    for (Pushed = 0; Pushed < PIPELINE_BATCH &&
+                     !__atomic_load_n(&QueueDone, __ATOMIC_ACQUIRE);)
+      Pushed += PushSamples(&Queue, Samples + Pushed, PIPELINE_BATCH - Pushed);
+    Seq += PIPELINE_BATCH;
+  }
+  return NULL;
+}
+
+// Pop samples from the queue for Duration seconds, while another thread
+// pushes them. (Overflows are not counted as samples.)
+void BenchQueue(double Duration, struct BenchResult *Result) {
+  struct AccelSample Samples[PIPELINE_BATCH];
+  pthread_t Producer;
+  double Start;
+  double CPUStart;
+  uint32_t Expected = 0;
+  int Count;
+  int i;
+
+  InitSampleQueue(&Queue);
+  QueueDone = 0;
+  Start = Now();
+  CPUStart = CPUNow();
+  if (pthread_create(&Producer, NULL, QueueProducer, NULL)) {
+    fprintf(stderr, "Could not start the producer thread.\n");
+    return;
+  }
+  while (Running && Now() - Start < Duration) {
+    for (i = 0; i < 1000; ++i) {
+      Count = PopSamples(&Queue, Samples, PIPELINE_BATCH);
+      if (Count && Samples[Count - 1].Seq != Expected + Count - 1)
+        fprintf(stderr, "queue_spsc: samples out of order.\n");
+      Expected += Count;
+      Result->Ops += Count;
+    }
+  }
+  __atomic_store_n(&QueueDone, 1, __ATOMIC_RELEASE);
+  pthread_join(Producer, NULL);
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+}
+
+/* END Acquisition Queue */
+
+/* BEGIN Report */
+
+// A JSON number, or null for unknown (negative) values.
+void PrintNumber(FILE *Out, const char *Key, double Value) {
+  if (Value < 0)
+    fprintf(Out, ", \"%s\": null", Key);
+  else
+    fprintf(Out, ", \"%s\": %.4f", Key, Value);
+}
+
+void WriteReport(FILE *Out, const char *Source, double Duration) {
+  struct BenchResult *Result;
+  int i;
+
+  fprintf(Out, "{\n  \"source\": \"%s\",\n  \"duration\": %.2f,\n", Source,
+          Duration);
+  fprintf(Out, "  \"results\": [\n");
+  for (i = 0; i < NumResults; ++i) {
+    Result = &Results[i];
+    fprintf(Out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %ld",
+            Result->Name, Result->Unit, Result->Ops);
+    PrintNumber(Out, "wall_s", Result->WallTime);
+    PrintNumber(Out, "cpu_s", Result->CPUTime);
+    fprintf(Out, ", \"simulated\": %s", Result->Simulated ? "true" : "false");
+    PrintNumber(Out, "ops_per_sec",
+                Result->WallTime > 0 && !Result->Simulated
+                    ? Result->Ops / Result->WallTime
+                    : -1);
+    PrintNumber(Out, "cpu_ns_per_op",
+                Result->Ops ? 1e9 * Result->CPUTime / Result->Ops : -1);
+    PrintNumber(Out, "i2c_xfers_per_op", Result->XfersPerOp);
+    PrintNumber(Out, "bytes_per_op", Result->BytesPerOp);
+    fprintf(Out, "}%s\n", i + 1 < NumResults ? "," : "");
+  }
+  fprintf(Out, "  ]\n}\n");
+}
+
+void PrintSummary(const char *Source) {
+  struct BenchResult *Result;
+  int i;
+
+  fprintf(stderr, "source: %s\n", Source);
+  for (i = 0; i < NumResults; ++i) {
+    Result = &Results[i];
+    if (Result->Simulated)
+      fprintf(stderr, "%-18s %14s", Result->Name, "(simulated)");
+    else
+      fprintf(stderr, "%-18s %12.0f %s/s", Result->Name,
+              Result->WallTime > 0 ? Result->Ops / Result->WallTime : 0.0,
+              Result->Unit);
+    fprintf(stderr, ", %.0f ns cpu/%s",
+            Result->Ops ? 1e9 * Result->CPUTime / Result->Ops : 0.0,
+            Result->Unit);
+    if (Result->XfersPerOp >= 0)
+      fprintf(stderr, ", %.2f i2c xfers/%s", Result->XfersPerOp,
+              Result->Unit);
+    if (Result->BytesPerOp >= 0)
+      fprintf(stderr, ", %.1f bytes/%s", Result->BytesPerOp, Result->Unit);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* END Report */
+
+int main(int argc, char **argv) {
+  double Duration = 2.0;
+  const char *ReportPath = "accelbench.json";
+  bool Simulate = false;
+  struct AccelConfig Saved;
+  uint32_t Rate = 3200000;
+  FILE *Report;
+  int Opt;
+
+  while ((Opt = getopt(argc, argv, "sd:o:")) != -1) {
+    switch (Opt) {
+    case 's':
+      Simulate = true;
+      break;
+    case 'd':
+      Duration = atof(optarg);
+      break;
+    case 'o':
+      ReportPath = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s] [-d seconds] [-o report.json]\n",
+              argv[0]);
+      return -1;
+    }
+  }
+
+  // 1. Register the SIGINT handler.
+  signal(SIGINT, IntHandler);
+
+  // 2. Use the driver if it's loaded, and the simulator otherwise.
+  if (!Simulate &&
+      (GetFD(ACCEL) = open(Drivers[ACCEL].Path, Drivers[ACCEL].RWP)) == -1)
+    Simulate = true;
+
+  // 3. The read path, at the highest output data rate.
+  if (Simulate) {
+    SimSetup();
+    BenchSim(Duration, 0, NewResult("sim_text", "sample"));
+    BenchSim(Duration, 1, NewResult("sim_binary", "sample"));
+    BenchSim(Duration, BATCH_SIZE, NewResult("sim_batched", "sample"));
+  } else {
+    IoctlTo(ACCEL, ACCEL_IOC_GET_CONFIG, &Saved);
+    IoctlTo(ACCEL, ACCEL_IOC_SET_RATE, &Rate);
+    BenchDevice(Duration, 0, NewResult("read_text", "sample"));
+    BenchDevice(Duration, 1, NewResult("read_binary", "sample"));
+    BenchDevice(Duration, BATCH_SIZE, NewResult("read_batched", "sample"));
+    IoctlTo(ACCEL, ACCEL_IOC_SET_RATE, &Saved.RateMilliHz);
+    ReleaseDrivers();
+  }
+
+  // 4. Text formatting and parsing, rendering, and the acquisition queue.
+  BenchParse(Duration, NewResult("parse_sscanf", "parse"));
+  BenchFormat(Duration, NewResult("format_datatostr", "format"));
+  BenchPlot(Duration, ENCODE_MINIMAL, NewResult("plot_frame", "frame"));
+  BenchPlot(Duration, ENCODE_PER_CELL,
+            NewResult("plot_frame_percell", "frame"));
+  BenchQueue(Duration, NewResult("queue_spsc", "sample"));
+
+  // 5. Report.
+  Report = strcmp(ReportPath, "-") == 0 ? stdout : fopen(ReportPath, "w");
+  if (!Report) {
+    fprintf(stderr, "Could not write %s.\n", ReportPath);
+    return -1;
+  }
+  WriteReport(Report, Simulate ? "sim" : "device", Duration);
+  if (Report != stdout)
+    fclose(Report);
+  PrintSummary(Simulate ? "sim" : "device");
+  return 0;
+}
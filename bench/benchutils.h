@@ -0,0 +1,24 @@
+#ifndef __BENCH_UTILS_H__
+#define __BENCH_UTILS_H__
+
+#include <sys/resource.h>
+#include <time.h>
+
+// Timing helpers shared by the benchmarks.
+
+// Wall clock time (s), CLOCK_MONOTONIC.
+double Now() {
+  struct timespec T;
+  clock_gettime(CLOCK_MONOTONIC, &T);
+  return T.tv_sec + T.tv_nsec * 1e-9;
+}
+
+// CPU time used by this process so far (s, user + system).
+double CPUNow() {
+  struct rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+  return Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec * 1e-6 +
+         Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec * 1e-6;
+}
+
+#endif
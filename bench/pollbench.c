@@ -0,0 +1,99 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "benchutils.h"
+#include "driverutils.h"
+
+// Compares the CPU cost of reading /dev/accel by busy-spinning on
+// non-blocking reads (how part2-4 used to read) against sleeping in
+// epoll_wait until the driver has a sample.
+//
+// Usage: ./pollbench.exe [seconds per method]
+
+#define BATCH_SIZE 64
+
+volatile sig_atomic_t Running = 1;
+
+void IntHandler(int inter) { Running = 0; }
+
+struct BenchResult {
+  long Samples;
+  long Reads;
+  double WallTime; // s
+  double CPUTime;  // s (user + system)
+};
+
+// Spin on non-blocking reads until Duration seconds have passed.
+void BenchSpin(double Duration, struct BenchResult *Result) {
+  struct AccelSample Samples[BATCH_SIZE];
+  double Start = Now();
+  double CPUStart = CPUNow();
+
+  while (Running && Now() - Start < Duration) {
+    Result->Samples += ReadSamplesFrom(ACCEL, Samples, BATCH_SIZE);
+    Result->Reads++;
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+}
+
+// Sleep in epoll_wait, and drain the driver each time it becomes readable.
+void BenchEpoll(double Duration, struct BenchResult *Result) {
+  struct AccelSample Samples[BATCH_SIZE];
+  struct epoll_event Event = {.events = EPOLLIN};
+  double Start = Now();
+  double CPUStart = CPUNow();
+  int Count;
+  int EpollFD;
+
+  if ((EpollFD = epoll_create1(0)) == -1 ||
+      epoll_ctl(EpollFD, EPOLL_CTL_ADD, GetFD(ACCEL), &Event) == -1) {
+    ErrorHandler("Could not set up epoll.");
+  }
+
+  while (Running && Now() - Start < Duration) {
+    if (epoll_wait(EpollFD, &Event, 1, 100) <= 0)
+      continue;
+    do {
+      Count = ReadSamplesFrom(ACCEL, Samples, BATCH_SIZE);
+      Result->Samples += Count;
+      Result->Reads++;
+    } while (Count == BATCH_SIZE);
+  }
+  Result->WallTime = Now() - Start;
+  Result->CPUTime = CPUNow() - CPUStart;
+  close(EpollFD);
+}
+
+void PrintResult(char *Method, struct BenchResult *Result) {
+  printf("%-6s samples=%-7ld reads=%-9ld cpu=%5.1f%% cpu/sample=%.2f us\n",
+         Method, Result->Samples, Result->Reads,
+         100.0 * Result->CPUTime / Result->WallTime,
+         Result->Samples ? 1e6 * Result->CPUTime / Result->Samples : 0.0);
+}
+
+int main(int argc, char **argv) {
+  double Duration = argc > 1 ? atof(argv[1]) : 5.0;
+  struct BenchResult Spin = {0};
+  struct BenchResult Epoll = {0};
+
+  // 1. Register the SIGINT handler.
+  signal(SIGINT, IntHandler);
+  // 2. Open the driver non-blocking, so that reads never sleep.
+  Drivers[ACCEL].RWP = O_RDWR | O_NONBLOCK;
+  OpenDrivers();
+  // 3. Ask the driver for binary samples.
+  WriteTo(ACCEL, "mode binary", 11);
+
+  // 4. Run both methods for the same amount of time.
+  BenchSpin(Duration, &Spin);
+  BenchEpoll(Duration, &Epoll);
+
+  PrintResult("spin", &Spin);
+  PrintResult("epoll", &Epoll);
+  ReleaseDrivers();
+  return 0;
+}
@@ -6,8 +6,12 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "accel_uapi.h"
+
 /* Bit values in INT_ENABLE, INT_MAP, and INT_SOURCE are identical
    use these bit values to read or write any of these registers.        */
 #define ACCEL_OVERRUN              0x01
@@ -26,7 +30,7 @@
 // Define Buffers for the two drivers
 // as well as their size.
 #define ACCEL_WRITE_SIZE 40
-#define ACCEL_READ_SIZE 40
+#define ACCEL_READ_SIZE 64
 
 char AccelWriteBuffer[ACCEL_WRITE_SIZE];
 char AccelReadBuffer[ACCEL_READ_SIZE];
@@ -98,12 +102,214 @@ void ReadFrom(int DevId, char *Buffer, int BufSize) {
     lseek(GetFD(DevId), 0, SEEK_SET);
 }
 
+// Read up to MaxSamples binary samples from the driver in a single read.
+// The driver must first be switched to binary mode
+// (i.e., WriteTo(ACCEL, "mode binary", 11)).
+// Blocks until a sample is available, unless the driver was opened with
+// O_NONBLOCK. Returns the number of samples read (0 if none was available).
+int ReadSamplesFrom(int DevId, struct AccelSample *Samples, int MaxSamples) {
+  ssize_t BytesRead =
+      read(GetFD(DevId), Samples, MaxSamples * sizeof(struct AccelSample));
+  if (BytesRead < 0) {
+    // No sample waiting (O_NONBLOCK), or interrupted by a signal.
+    if (errno == EAGAIN || errno == EINTR)
+      return 0;
+    ErrorHandler("Sample read was unsuccessful.");
+  }
+  return BytesRead / sizeof(struct AccelSample);
+}
+
+// Parse a text mode sample ("RR XXXX YYYY ZZZZ SS NNNN TTTT", as read with
+// ReadFrom(...)). Returns 1 if it was parsed, 0 otherwise.
+int ParseSample(const char *Text, struct AccelSample *Sample) {
+  unsigned long long Timestamp;
+
+  if (sscanf(Text, "%hhx %hd %hd %hd %hd %u %llu", &Sample->Status,
+             &Sample->X, &Sample->Y, &Sample->Z, &Sample->Scale, &Sample->Seq,
+             &Timestamp) != 7)
+    return 0;
+  Sample->Timestamp = Timestamp;
+  return 1;
+}
+
+// The current time (ns) on the clock samples and events are timestamped
+// with (CLOCK_MONOTONIC).
+uint64_t MonotonicNs() {
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+// Follows the sequence numbers and timestamps of the samples a program
+// reads: how many samples it missed, and the actual output data rate and
+// its jitter (as opposed to the configured rate). Start zeroed.
+struct AccelSampleTracker {
+  uint32_t LastSeq;
+  uint64_t LastTimestamp;
+  uint64_t Samples;   // Samples seen
+  uint64_t Missed;    // Samples skipped over (gaps in the sequence)
+  uint64_t Intervals; // Intervals measured (between consecutive samples)
+  uint64_t MinIntervalNs;
+  uint64_t MaxIntervalNs;
+  double SumIntervalNs;
+};
+
+// Account for a sample. Records without ACCEL_DATAREADY (events only) are
+// ignored. Returns the number of samples missed just before this one.
+uint32_t TrackSample(struct AccelSampleTracker *Tracker,
+                     const struct AccelSample *Sample) {
+  uint32_t Missed = 0;
+  uint64_t Interval;
+
+  if (!(Sample->Status & ACCEL_DATAREADY))
+    return 0;
+  if (Tracker->Samples) {
+    Missed = Sample->Seq - Tracker->LastSeq - 1;
+    Tracker->Missed += Missed;
+    // Only consecutive samples tell the period.
+    if (!Missed && Sample->Timestamp >= Tracker->LastTimestamp) {
+      Interval = Sample->Timestamp - Tracker->LastTimestamp;
+      if (!Tracker->Intervals || Interval < Tracker->MinIntervalNs)
+        Tracker->MinIntervalNs = Interval;
+      if (Interval > Tracker->MaxIntervalNs)
+        Tracker->MaxIntervalNs = Interval;
+      Tracker->SumIntervalNs += Interval;
+      Tracker->Intervals++;
+    }
+  }
+  Tracker->LastSeq = Sample->Seq;
+  Tracker->LastTimestamp = Sample->Timestamp;
+  Tracker->Samples++;
+  return Missed;
+}
+
+// The measured output data rate (Hz), or 0 if it isn't known yet.
+double TrackedRate(const struct AccelSampleTracker *Tracker) {
+  if (!Tracker->Intervals || Tracker->SumIntervalNs <= 0)
+    return 0;
+  return 1e9 * Tracker->Intervals / Tracker->SumIntervalNs;
+}
+
+// The peak to peak jitter of the sample interval (ns).
+uint64_t TrackedJitter(const struct AccelSampleTracker *Tracker) {
+  return Tracker->MaxIntervalNs - Tracker->MinIntervalNs;
+}
+
+// Read a single binary sample from the driver. If no new sample was
+// available, Sample->Status is cleared (so ACCEL_DATAREADY is not set).
+void ReadSampleFrom(int DevId, struct AccelSample *Sample) {
+  if (ReadSamplesFrom(DevId, Sample, 1) == 0)
+    Sample->Status = 0;
+}
+
+// A consumer of a driver's sample ring, mapped into our address space with
+// MapRingFrom(...). Samples are read straight from the shared pages by
+// ReadRingFrom(...): no system call and no copy_to_user per sample.
+struct AccelRingReader {
+  const struct AccelRingHeader *Header;
+  const struct AccelSample *Samples;
+  uint32_t Mask;    // Size - 1
+  uint32_t Tail;    // The next sample to read
+  uint32_t Lost;    // Samples overwritten before we could read them
+  size_t MapSize;
+};
+
+// Map the sample ring of a driver. Only samples produced after this call
+// will be returned by ReadRingFrom(...).
+void MapRingFrom(int DevId, struct AccelRingReader *Reader) {
+  void *Ring;
+  uint32_t Size;
+
+  // Map the header alone first, to find out how large the ring is.
+  Ring = mmap(NULL, sizeof(struct AccelRingHeader), PROT_READ, MAP_SHARED,
+              GetFD(DevId), 0);
+  if (Ring == MAP_FAILED) {
+    ErrorHandler("Failed to map the sample ring.");
+  }
+  Size = ((const struct AccelRingHeader *)Ring)->Size;
+  munmap(Ring, sizeof(struct AccelRingHeader));
+
+  Reader->MapSize = ACCEL_RING_MAP_SIZE(Size);
+  Ring = mmap(NULL, Reader->MapSize, PROT_READ, MAP_SHARED, GetFD(DevId), 0);
+  if (Ring == MAP_FAILED) {
+    ErrorHandler("Failed to map the sample ring.");
+  }
+  Reader->Header = Ring;
+  Reader->Samples =
+      (const struct AccelSample *)((const char *)Ring + ACCEL_RING_DATA_OFFSET);
+  Reader->Mask = Size - 1;
+  Reader->Tail = __atomic_load_n(&Reader->Header->Head, __ATOMIC_ACQUIRE);
+  Reader->Lost = 0;
+}
+
+// Copy up to MaxSamples new samples out of a mapped sample ring.
+// Returns the number of samples copied (0 if there are none).
+int ReadRingFrom(struct AccelRingReader *Reader, struct AccelSample *Samples,
+                 int MaxSamples) {
+  uint32_t Head;
+  uint32_t Count;
+  uint32_t i;
+
+  for (;;) {
+    // If the driver has lapped us, skip forward to the oldest valid sample.
+    // Sample N is valid while Head - N < Size, i.e. <= Mask (accel_uapi.h).
+    Head = __atomic_load_n(&Reader->Header->Head, __ATOMIC_ACQUIRE);
+    if (Head - Reader->Tail > Reader->Mask) {
+      Reader->Lost += Head - Reader->Tail - Reader->Mask;
+      Reader->Tail = Head - Reader->Mask;
+    }
+    Count = Head - Reader->Tail;
+    if (Count > (uint32_t)MaxSamples)
+      Count = MaxSamples;
+
+    for (i = 0; i < Count; ++i)
+      Samples[i] = Reader->Samples[(Reader->Tail + i) & Reader->Mask];
+
+    // Finish the copies before re-checking the head: if the driver has
+    // since started overwriting our oldest sample (the same rule), the copy
+    // may be torn.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    Head = __atomic_load_n(&Reader->Header->Head, __ATOMIC_RELAXED);
+    if (Head - Reader->Tail <= Reader->Mask)
+      break;
+  }
+  Reader->Tail += Count;
+  return Count;
+}
+
+void UnmapRing(struct AccelRingReader *Reader) {
+  munmap((void *)Reader->Header, Reader->MapSize);
+  Reader->Header = NULL;
+}
+
 void WriteTo(int DevId, char *Buffer, int BufSize) {
   if (write(GetFD(DevId), Buffer, BufSize) < 0) {
     ErrorHandler("Write was unsuccessful.");
   }
 }
 
+// Issue one of the typed ACCEL_IOC_* requests (see accel_uapi.h).
+// For "set" requests, Arg holds the effective value on return.
+void IoctlTo(int DevId, unsigned long Request, void *Arg) {
+  if (ioctl(GetFD(DevId), Request, Arg) < 0) {
+    ErrorHandler("ioctl was unsuccessful.");
+  }
+}
+
+// Take up to MaxEvents of this open file's unread events (taps, activity,
+// ...) from the driver, oldest first. Returns the number of events read.
+// If Lost is not NULL, it is set to the number of events missed because
+// they weren't read in time.
+int ReadEventsFrom(int DevId, struct AccelEvent *Events, int MaxEvents,
+                   uint32_t *Lost) {
+  struct AccelEventRead EventRead = {.Events = (uintptr_t)Events,
+                                     .Max = MaxEvents};
+  IoctlTo(DevId, ACCEL_IOC_READ_EVENTS, &EventRead);
+  if (Lost)
+    *Lost = EventRead.Lost;
+  return EventRead.Count;
+}
+
 // Using strtoumax, convert a string to a uint.
 // If successful, set Safe to be 1 and return the
 // mapped value.
@@ -10,8 +10,8 @@
 #include "ADXL345.h"
 #include "fileio.h"
 
-unsigned int *SYSMGRVirt;
-unsigned int *I2C0Virt;
+volatile unsigned int *SYSMGRVirt;
+volatile unsigned int *I2C0Virt;
 
 int Running = 1;
 
@@ -23,7 +23,8 @@ void SIGINTHandler(int Interrupt) {
 /* This program increments the contents of the red LED parallel port */
 int main(void) {
 
-  uint8_t DevID;
+  uint8_t DevID = 0;
+  uint8_t IntSource;
   int16_t MGPerLSB = 4;
   int16_t XYZ[3];
 
@@ -47,7 +48,10 @@ int main(void) {
   Pinmux_Config();
 
   // Initialize I2C0 Controller
-  I2C0_Init();
+  if (I2C0_Init()) {
+    printf("I2C0 did not respond.\n");
+    return -1;
+  }
 
   // 0xE5 is read from DEVID(0x00) if I2C is functioning correctly
   ADXL345_REG_READ(ADXL345_REG_DEVID, &DevID);
@@ -58,22 +62,25 @@ int main(void) {
   }
 
   MGPerLSB = ROUNDED_DIVISION(16 * 1000, 512);
-  ADXL345_Init();
-  ADXL345_Calibrate();
+  if (ADXL345_Init() || ADXL345_Calibrate()) {
+    printf("ADXL345 setup failed.\n");
+    return -1;
+  }
 
   while (Running) {
-    // Poll the DATA_READY bit from the interrupt register.
-    if (ADXL345_IsDataReady()) {
+    // Poll the DATA_READY bit from the interrupt register (the XYZ data is
+    // fetched in the same I2C transaction).
+    if (ADXL345_StatusXYZ_Read(XYZ, &IntSource) == 0 &&
+        (IntSource & XL345_DATAREADY)) {
       // If data is ready... spit it out to stdout.
-      ADXL345_XYZ_Read(XYZ);
       printf("X=%d mg, Y=%d mg, Z=%d mg\n", XYZ[0] * MGPerLSB,
              XYZ[1] * MGPerLSB, XYZ[2] * MGPerLSB);
     }
   }
 
-  unmap_physical(SYSMGRVirt,
+  unmap_physical((void *)SYSMGRVirt,
                  SYSMGR_SPAN);         // release the physical-memory mapping
-  unmap_physical(I2C0Virt, I2C0_SPAN); // release the physical-memory mapping
+  unmap_physical((void *)I2C0Virt, I2C0_SPAN); // release the physical-memory mapping
   close_physical(fd);                  // close /dev/mem
 
   return 0;
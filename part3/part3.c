@@ -1,9 +1,12 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "driverutils.h"
+#include "pipeline.h"
 #include "plotutils.h"
 
 volatile sig_atomic_t Running = 1;
@@ -11,49 +14,101 @@ struct timespec AnimationTime;
 
 void IntHandler(int inter) { Running = 0; }
 
-int main() {
+// Samples taken from the acquisition pipeline at a time.
+#define SAMPLE_BATCH 64
+
+// Usage: ./part3.exe [-c cpu] [-p priority]
+// The acquisition thread is pinned to cpu, and runs with the SCHED_FIFO
+// priority (1 - 99) when one is given.
+int main(int argc, char **argv) {
 
   int16_t X;
   int16_t Y;
   int16_t Z;
   int i;
-  uint8_t InterruptStatus;
+  int Count;
+  int Fresh;
   int16_t ScaleFactor;
+  struct AccelSample Samples[SAMPLE_BATCH];
+  struct AccelSample Latest;
+  struct AccelOffsets Offsets;
+  struct FramePacer Pacer;
+  struct Pipeline Acquisition;
+  int Cpu = -1;
+  int Priority = 0;
+  int Opt;
   char OutputString[50];
 
   float AvgX = 0, AvgY = 0;
 
+  while ((Opt = getopt(argc, argv, "c:p:")) != -1) {
+    switch (Opt) {
+    case 'c':
+      Cpu = atoi(optarg);
+      break;
+    case 'p':
+      Priority = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-c cpu] [-p priority]\n", argv[0]);
+      return -1;
+    }
+  }
+
   // 1. Register the SIGINT handler.
   signal(SIGINT, IntHandler);
   // 2. Using the API from driverutils.h, open the driver(s)
   OpenDrivers();
   // 3. Re-Initialize the Accelerometer
   WriteTo(ACCEL, "init", 4);
-  // 4. Calibrate the accelerometer.
-  WriteTo(ACCEL, "calibrate", 9);
+  // 4. Calibrate the accelerometer (unless the driver already has offsets:
+  //    init leaves them alone).
+  IoctlTo(ACCEL, ACCEL_IOC_GET_OFFSETS, &Offsets);
+  if (!Offsets.Calibrated)
+    WriteTo(ACCEL, "calibrate", 9);
+  // 5. Ask the driver for binary samples (no string formatting/parsing).
+  WriteTo(ACCEL, "mode binary", 11);
+  // Read the samples on their own thread (pipeline.h), so drawing never
+  // holds up the next read.
+  if (StartPipeline(&Acquisition, ACCEL, Cpu, Priority))
+    ErrorHandler("Failed to start the acquisition thread.");
 
-  // 5. Initialize the terminal to be "drawable"
+  // 6. Initialize the terminal to be "drawable", and redraw it FRAME_RATE
+  //    times per second (the acquisition thread keeps reading at the full
+  //    output data rate in between).
   InitializeTerminal();
+  StartFramePacer(&Pacer, FRAME_RATE);
 
-  while (Running) {
-    // 6. Read from the accel driver.
-    ReadFrom(ACCEL, AccelReadBuffer, ACCEL_READ_SIZE);
+  while (Running && !PipelineError(&Acquisition)) {
+    // 7. Drain every sample the acquisition thread read since the last frame.
+    //    Each one goes into the moving average (a smoothing factor), and the
+    //    newest one is displayed.
+    Fresh = 0;
+    do {
+      Count = ReadPipeline(&Acquisition, Samples, SAMPLE_BATCH);
+      for (i = 0; i < Count; ++i) {
+        if (!(Samples[i].Status & ACCEL_DATAREADY))
+          continue;
+        AvgX = AvgX * 0.3 + Samples[i].X * (0.7);
+        AvgY = AvgY * 0.3 + Samples[i].Y * (0.7);
+        Latest = Samples[i];
+        Fresh = 1;
+      }
+    } while (Count == SAMPLE_BATCH && Running);
 
-    // 7. If the Circle representing the position of the accelerometer is valid,
-    //    clear the previous circle by drawing over it.
-    if (Main.Valid)
-      ClearCircle(Main.X, Main.Y, Main.R);
+    if (Fresh) {
+      // 8. If the Circle representing the position of the accelerometer is
+      //    valid, clear the previous circle by drawing over it.
+      if (Main.Valid)
+        ClearCircle(Main.X, Main.Y, Main.R);
 
-    // 8. Re-interpret the string from AccelReadBuffer via sscanf into
-    // variables.
-    if (sscanf(AccelReadBuffer, "%hhx %hd %hd %hd %hd", &InterruptStatus, &X,
-               &Y, &Z, &ScaleFactor) < 0) {
-      ErrorHandler("Could not determine accelerometer output.");
-    }
+      // 9. Unpack the newest sample into variables.
+      X = Latest.X;
+      Y = Latest.Y;
+      Z = Latest.Z;
+      ScaleFactor = Latest.Scale;
 
-    // 9. If the InterruptStatus indicates we have data, display the data on the
-    // top-left of the screen (as a string)
-    if (InterruptStatus & ACCEL_DATAREADY) {
+      // 10. Display the data on the top-left of the screen (as a string)
       if (snprintf(OutputString, 50, "X=%4d Y=%4d Z=%4d (milli m/s^2)\n",
                    X * ScaleFactor, Y * ScaleFactor, Z * ScaleFactor) < 0) {
         printf("Error: snprintf was unsuccessful");
@@ -63,11 +118,8 @@ int main() {
       for (i = 0; i < strlen(OutputString) - 1; ++i)
         PlotChar(i + 1, 3, GREEN, OutputString[i]);
 
-      // Now, take those coordinates, and fill-in the fields of the circle
-      // struct (with respect to the center of the terminal) We use a smoothing
-      // factor here by taking a moving average!
-      AvgX = AvgX * 0.3 + X * (0.7);
-      AvgY = AvgY * 0.3 + Y * (0.7);
+      // Now, take the smoothed coordinates, and fill-in the fields of the
+      // circle struct (with respect to the center of the terminal).
       Main.X = (int)AvgX + (XRange >> 1);
       Main.Y = (int)AvgY + (YRange >> 1);
       // Set the radius to be 4.
@@ -78,10 +130,28 @@ int main() {
     // Plot the circle if the circle is valid.
     if (Main.Valid)
       PlotCircle(Main.X, Main.Y, Main.R, RED);
+    // Send the changes of this frame to the terminal, then wait for the
+    // next one.
+    PresentFrame();
+    WaitForFrame(&Pacer);
   }
+  StopPipeline(&Acquisition);
   ResetTerminal();
   // Flush all in buffer to stdout.
   fflush(stdout);
+  // Report how the acquisition queue coped, so it can be sized.
+  if (Acquisition.SchedError)
+    fprintf(stderr, "Acquisition thread: -c/-p not applied (%s).\n",
+            strerror(Acquisition.SchedError));
+  fprintf(stderr, "Acquisition queue: %u/%d samples at most, %u dropped.\n",
+          Acquisition.Queue.HighWater, SAMPLE_QUEUE_SIZE,
+          Acquisition.Queue.Overflows);
+  // A read which failed on the acquisition thread is reported now that the
+  // terminal is back to normal.
+  if (Acquisition.ReadError) {
+    errno = Acquisition.ReadError;
+    ErrorHandler("Sample read was unsuccessful.");
+  }
   // Release all drivers.
   ReleaseDrivers();
   return 0;
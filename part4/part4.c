@@ -1,73 +1,144 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "driverutils.h"
+#include "pipeline.h"
 #include "plotutils.h"
 
+// How long the tap indicators stay on screen.
+#define TAP_DISPLAY_NS 2000000000ULL
+
+// Samples taken from the acquisition pipeline at a time.
+#define SAMPLE_BATCH 64
+
 volatile sig_atomic_t Running = 1;
 struct timespec AnimationTime;
 
 void IntHandler(int inter) { Running = 0; }
 
-int main() {
+// Usage: ./part4.exe [-c cpu] [-p priority]
+// The acquisition thread is pinned to cpu, and runs with the SCHED_FIFO
+// priority (1 - 99) when one is given.
+int main(int argc, char **argv) {
 
-  clock_t SingleStartTime;
-  clock_t DoubleStartTime;
+  // Timestamps (CLOCK_MONOTONIC, ns) of the last single/double tap.
+  uint64_t SingleTapTime = 0;
+  uint64_t DoubleTapTime = 0;
+  uint64_t Now;
   int16_t X;
   int16_t Y;
   int16_t Z;
   int i;
+  int Count;
+  int Fresh;
   uint8_t InterruptStatus;
   int16_t ScaleFactor;
+  struct AccelSample Samples[SAMPLE_BATCH];
+  struct AccelSample Latest;
+  struct AccelOffsets Offsets;
+  struct FramePacer Pacer;
+  struct Pipeline Acquisition;
+  int Cpu = -1;
+  int Priority = 0;
+  int Opt;
   char OutputString[50];
   char SingleTapEvent[] = "Single Tap!";
   char DoubleTapEvent[] = "Double Tap!";
 
   float AvgX = 0, AvgY = 0;
 
+  while ((Opt = getopt(argc, argv, "c:p:")) != -1) {
+    switch (Opt) {
+    case 'c':
+      Cpu = atoi(optarg);
+      break;
+    case 'p':
+      Priority = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-c cpu] [-p priority]\n", argv[0]);
+      return -1;
+    }
+  }
+
   // 1. Register the SIGINT handler.
   signal(SIGINT, IntHandler);
   // 2. Using the API from driverutils.h, open the driver(s)
   OpenDrivers();
   // 3. Re-Initialize the Accelerometer
   WriteTo(ACCEL, "init", 4);
-  // 4. Calibrate the accelerometer.
-  WriteTo(ACCEL, "calibrate", 9);
-
+  // 4. Calibrate the accelerometer (unless the driver already has offsets:
+  //    init leaves them alone).
+  IoctlTo(ACCEL, ACCEL_IOC_GET_OFFSETS, &Offsets);
+  if (!Offsets.Calibrated)
+    WriteTo(ACCEL, "calibrate", 9);
+  // 5. Ask the driver for binary samples (no string formatting/parsing).
+  WriteTo(ACCEL, "mode binary", 11);
+  // Read the samples on their own thread (pipeline.h), so drawing never
+  // holds up the next read.
+  if (StartPipeline(&Acquisition, ACCEL, Cpu, Priority))
+    ErrorHandler("Failed to start the acquisition thread.");
+
+  // Redraw the terminal FRAME_RATE times per second (the acquisition thread
+  // keeps reading at the full output data rate in between).
   InitializeTerminal();
+  StartFramePacer(&Pacer, FRAME_RATE);
+
+  while (Running && !PipelineError(&Acquisition)) {
+    // 6. Drain every sample the acquisition thread read since the last frame.
+    //    Each one goes into the moving average, the newest one is displayed,
+    //    and the interrupts of all of them are combined (so a tap is seen,
+    //    even if it wasn't in the newest sample).
+    Fresh = 0;
+    InterruptStatus = 0;
+    do {
+      Count = ReadPipeline(&Acquisition, Samples, SAMPLE_BATCH);
+      for (i = 0; i < Count; ++i) {
+        InterruptStatus |= Samples[i].Status;
+        if (Samples[i].Status & ACCEL_SINGLETAP)
+          SingleTapTime = Samples[i].Timestamp;
+        if (Samples[i].Status & ACCEL_DOUBLETAP)
+          DoubleTapTime = Samples[i].Timestamp;
+        if (!(Samples[i].Status & ACCEL_DATAREADY))
+          continue;
+        AvgX = AvgX * 0.3 + Samples[i].X * (0.7);
+        AvgY = AvgY * 0.3 + Samples[i].Y * (0.7);
+        Latest = Samples[i];
+        Fresh = 1;
+      }
+    } while (Count == SAMPLE_BATCH && Running);
 
-  while (Running) {
-    // 5. Read from /dev/accel, find out if we've received data.
-    ReadFrom(ACCEL, AccelReadBuffer, ACCEL_READ_SIZE);
-
-    // 6.  If the Circle representing the position of the accelerometer is
-    // valid,
-    //    clear the previous circle by drawing over it.
-    if (Main.Valid)
+    // 7.  If the Circle representing the position of the accelerometer is
+    // valid, and it moved, clear the previous circle by drawing over it.
+    if (Fresh && Main.Valid)
       ClearCircle(Main.X, Main.Y, Main.R);
 
-    // 7. After 2 seconds clear any indicators for single/double taps. 
-    if (((clock() - SingleStartTime) / CLOCKS_PER_SEC) > 2.0) {
+    // 8. 2 seconds after a tap was sensed (the sample's timestamp is on the
+    //    same clock as MonotonicNs), clear its indicator.
+    Now = MonotonicNs();
+    if (SingleTapTime && Now - SingleTapTime > TAP_DISPLAY_NS) {
       for (i = 0; i < 11; ++i)
         PlotChar(i + 1, 3, BLACK, ' ');
+      SingleTapTime = 0;
     }
 
-    if (((clock() - DoubleStartTime) / CLOCKS_PER_SEC) > 2.0) {
+    if (DoubleTapTime && Now - DoubleTapTime > TAP_DISPLAY_NS) {
       for (i = 0; i < 11; ++i)
         PlotChar(i + 1, 4, BLACK, ' ');
+      DoubleTapTime = 0;
     }
 
-    // Re-interpret the string from AccelReadBuffer via sscanf into variables.
-    if (sscanf(AccelReadBuffer, "%hhx %hd %hd %hd %hd", &InterruptStatus, &X,
-               &Y, &Z, &ScaleFactor) < 0) {
-      ErrorHandler("Could not determine accelerometer output.");
-    }
-
-    // If the InterruptStatus indicates we have data, display the data on the
-    // top-left of the screen (as a string)
-    if (InterruptStatus & ACCEL_DATAREADY) {
+    // If we have new data, display the newest sample on the top-left of the
+    // screen (as a string)
+    if (Fresh) {
+      X = Latest.X;
+      Y = Latest.Y;
+      Z = Latest.Z;
+      ScaleFactor = Latest.Scale;
       if (snprintf(OutputString, 50, "X=%4d Y=%4d Z=%4d (milli m/s^2)\n",
                    X * ScaleFactor, Y * ScaleFactor, Z * ScaleFactor) < 0) {
         printf("Error: snprintf was unsuccessful");
@@ -77,36 +148,49 @@ int main() {
       for (i = 0; i < strlen(OutputString) - 1; ++i)
         PlotChar(i + 1, 1, GREEN, OutputString[i]);
 
-      AvgX = AvgX * 0.3 + X * (0.7);
-      AvgY = AvgY * 0.3 + Y * (0.7);
       Main.X = (int)AvgX + (XRange >> 1);
       Main.Y = (int)AvgY + (YRange >> 1);
       Main.R = 3;
       Main.Valid = 1;
     }
     // Also ask InterruptStatus if a SINGLETAP or DOUBLETAP event has been
-    // captured. (e.g., the interrupts should be high) If a SINGLETAP or
-    // DOUBLETAP event has occured, display: "Single Tap!" or "Double Tap!"
-    // below the XYZ string.
+    // captured during this frame. (e.g., the interrupts should be high) If a
+    // SINGLETAP or DOUBLETAP event has occured, display: "Single Tap!" or
+    // "Double Tap!" below the XYZ string.
     if (InterruptStatus & ACCEL_SINGLETAP) {
       for (i = 0; i < 11; ++i)
         PlotChar(i + 1, 3, YELLOW, SingleTapEvent[i]);
-      SingleStartTime = clock();
     }
 
     if (InterruptStatus & ACCEL_DOUBLETAP) {
       for (i = 0; i < 11; ++i)
         PlotChar(i + 1, 4, MAGENTA, DoubleTapEvent[i]);
-      DoubleStartTime = clock();
     }
 
     if (Main.Valid)
       PlotCircle(Main.X, Main.Y, Main.R, RED);
-
+    // Send the changes of this frame to the terminal, then wait for the
+    // next one.
+    PresentFrame();
+    WaitForFrame(&Pacer);
   }
+  StopPipeline(&Acquisition);
   ResetTerminal();
   // Flush all in buffer to stdout.
   fflush(stdout);
+  // Report how the acquisition queue coped, so it can be sized.
+  if (Acquisition.SchedError)
+    fprintf(stderr, "Acquisition thread: -c/-p not applied (%s).\n",
+            strerror(Acquisition.SchedError));
+  fprintf(stderr, "Acquisition queue: %u/%d samples at most, %u dropped.\n",
+          Acquisition.Queue.HighWater, SAMPLE_QUEUE_SIZE,
+          Acquisition.Queue.Overflows);
+  // A read which failed on the acquisition thread is reported now that the
+  // terminal is back to normal.
+  if (Acquisition.ReadError) {
+    errno = Acquisition.ReadError;
+    ErrorHandler("Sample read was unsuccessful.");
+  }
   // Release all drivers.
   ReleaseDrivers();
   return 0;
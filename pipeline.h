@@ -0,0 +1,199 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+// CPU affinity (cpu_set_t, pthread_setaffinity_np) is a GNU extension.
+#ifndef _GNU_SOURCE
+#error "pipeline.h needs _GNU_SOURCE: build with -D_GNU_SOURCE -pthread"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "driverutils.h"
+
+// Acquisition Pipeline:
+// A dedicated reader thread takes binary samples from a driver (in batches,
+// blocking until they arrive) and pushes them into a bounded queue. The
+// render thread pops whatever has arrived when it gets to it. So a slow
+// terminal write never delays the next read: the queue absorbs it.
+//
+// The queue is a single producer/single consumer ring without locks: only
+// the reader thread writes Head, only the render thread writes Tail, and
+// each publishes the slots it is done with by a release store of its index
+// (which the other side reads with an acquire load). When the queue is full
+// the newest samples are dropped and counted in Overflows; HighWater is the
+// fullest the queue has been, so the two can be used to size it.
+
+#define SAMPLE_QUEUE_SIZE 4096 // Must be a power of two.
+#define SAMPLE_QUEUE_MASK (SAMPLE_QUEUE_SIZE - 1)
+#define PIPELINE_BATCH 64 // Samples taken from the driver per read
+#define CACHE_LINE 64
+
+struct SampleQueue {
+  struct AccelSample Slots[SAMPLE_QUEUE_SIZE];
+  // Each index on its own cache line, so the threads don't share one.
+  uint32_t Head __attribute__((aligned(CACHE_LINE))); // Samples pushed
+  uint32_t Overflows; // Samples dropped because the queue was full
+  uint32_t HighWater; // Most samples ever waiting in the queue
+  uint32_t Tail __attribute__((aligned(CACHE_LINE))); // Samples popped
+};
+
+void InitSampleQueue(struct SampleQueue *Queue) {
+  Queue->Head = 0;
+  Queue->Tail = 0;
+  Queue->Overflows = 0;
+  Queue->HighWater = 0;
+}
+
+// (Producer) Push up to Count samples. Returns the number pushed: the rest
+// didn't fit, and were counted as overflows.
+int PushSamples(struct SampleQueue *Queue, const struct AccelSample *Samples,
+                int Count) {
+  uint32_t Head = Queue->Head;
+  uint32_t Tail = __atomic_load_n(&Queue->Tail, __ATOMIC_ACQUIRE);
+  uint32_t Free = SAMPLE_QUEUE_SIZE - (Head - Tail);
+  uint32_t Pushed = (uint32_t)Count < Free ? (uint32_t)Count : Free;
+  uint32_t i;
+
+  for (i = 0; i < Pushed; ++i)
+    Queue->Slots[(Head + i) & SAMPLE_QUEUE_MASK] = Samples[i];
+  __atomic_store_n(&Queue->Head, Head + Pushed, __ATOMIC_RELEASE);
+
+  if (Pushed < (uint32_t)Count)
+    __atomic_fetch_add(&Queue->Overflows, Count - Pushed, __ATOMIC_RELAXED);
+  if (Head + Pushed - Tail > Queue->HighWater)
+    __atomic_store_n(&Queue->HighWater, Head + Pushed - Tail,
+                     __ATOMIC_RELAXED);
+  return Pushed;
+}
+
+// (Consumer) Pop up to MaxSamples samples, oldest first. Returns the number
+// popped (0 if the queue is empty).
+int PopSamples(struct SampleQueue *Queue, struct AccelSample *Samples,
+               int MaxSamples) {
+  uint32_t Tail = Queue->Tail;
+  uint32_t Head = __atomic_load_n(&Queue->Head, __ATOMIC_ACQUIRE);
+  uint32_t Count = Head - Tail;
+  uint32_t i;
+
+  if (Count > (uint32_t)MaxSamples)
+    Count = MaxSamples;
+  for (i = 0; i < Count; ++i)
+    Samples[i] = Queue->Slots[(Tail + i) & SAMPLE_QUEUE_MASK];
+  __atomic_store_n(&Queue->Tail, Tail + Count, __ATOMIC_RELEASE);
+  return Count;
+}
+
+struct Pipeline {
+  struct SampleQueue Queue;
+  int DevId;
+  int Cpu;      // CPU the reader thread is pinned to (-1: any)
+  int Priority; // SCHED_FIFO priority of the reader thread (0: not real-time)
+  int SchedError; // Why Cpu/Priority couldn't be applied (errno), or 0
+  int ReadError;  // Why the reader thread stopped reading (errno), or 0
+  int Stop;
+  uint64_t Reads; // read() calls which returned samples
+  pthread_t Reader;
+};
+
+// The reader thread: move samples from the driver into the queue until the
+// pipeline is stopped, or a read fails. A failure is left in ReadError for
+// the render thread to report (this thread can't restore the terminal).
+void *PipelineReader(void *Arg) {
+  struct Pipeline *Pipeline = Arg;
+  struct AccelSample Samples[PIPELINE_BATCH];
+  struct sched_param Param;
+  cpu_set_t Cpus;
+  ssize_t BytesRead;
+  int Count;
+  int Error;
+
+  // Pin and prioritize the thread, if asked to. Without the privileges
+  // (e.g., for SCHED_FIFO), carry on as a normal thread.
+  if (Pipeline->Cpu >= 0) {
+    CPU_ZERO(&Cpus);
+    CPU_SET(Pipeline->Cpu, &Cpus);
+    if ((Error = pthread_setaffinity_np(pthread_self(), sizeof(Cpus), &Cpus)))
+      Pipeline->SchedError = Error;
+  }
+  if (Pipeline->Priority > 0) {
+    memset(&Param, 0, sizeof(Param));
+    Param.sched_priority = Pipeline->Priority;
+    if ((Error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param)))
+      Pipeline->SchedError = Error;
+  }
+
+  while (!__atomic_load_n(&Pipeline->Stop, __ATOMIC_ACQUIRE)) {
+    // (Not ReadSamplesFrom: it exits on an error.)
+    BytesRead = read(GetFD(Pipeline->DevId), Samples, sizeof(Samples));
+    if (BytesRead < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        continue;
+      __atomic_store_n(&Pipeline->ReadError, errno, __ATOMIC_RELEASE);
+      break;
+    }
+    Count = BytesRead / sizeof(struct AccelSample);
+    if (Count > 0) {
+      PushSamples(&Pipeline->Queue, Samples, Count);
+      __atomic_fetch_add(&Pipeline->Reads, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+// Start reading binary samples from DevId (which must be in binary mode, and
+// opened without O_NONBLOCK) on a new thread. Cpu (or -1) and Priority (or
+// 0) are applied to that thread. Returns 0, or an errno value if the thread
+// couldn't be started.
+int StartPipeline(struct Pipeline *Pipeline, int DevId, int Cpu,
+                  int Priority) {
+  sigset_t All;
+  sigset_t Saved;
+  int Error;
+
+  InitSampleQueue(&Pipeline->Queue);
+  Pipeline->DevId = DevId;
+  Pipeline->Cpu = Cpu;
+  Pipeline->Priority = Priority;
+  Pipeline->SchedError = 0;
+  Pipeline->ReadError = 0;
+  Pipeline->Stop = 0;
+  Pipeline->Reads = 0;
+
+  // Signals (i.e., SIGINT) are left to the render thread: the reader thread
+  // starts with all of them blocked.
+  sigfillset(&All);
+  pthread_sigmask(SIG_SETMASK, &All, &Saved);
+  Error = pthread_create(&Pipeline->Reader, NULL, PipelineReader, Pipeline);
+  pthread_sigmask(SIG_SETMASK, &Saved, NULL);
+  return Error;
+}
+
+// Take up to MaxSamples of the samples read so far, oldest first. Returns the
+// number taken (0 if none has arrived since the last call).
+int ReadPipeline(struct Pipeline *Pipeline, struct AccelSample *Samples,
+                 int MaxSamples) {
+  return PopSamples(&Pipeline->Queue, Samples, MaxSamples);
+}
+
+// Returns the errno value of the read which stopped the reader thread, or 0
+// while it is still reading. The pipeline must still be stopped.
+int PipelineError(struct Pipeline *Pipeline) {
+  return __atomic_load_n(&Pipeline->ReadError, __ATOMIC_ACQUIRE);
+}
+
+// Stop the reader thread and wait for it. It may be blocked in a read, which
+// is a cancellation point.
+void StopPipeline(struct Pipeline *Pipeline) {
+  __atomic_store_n(&Pipeline->Stop, 1, __ATOMIC_RELEASE);
+  pthread_cancel(Pipeline->Reader);
+  pthread_join(Pipeline->Reader, NULL);
+}
+
+#endif
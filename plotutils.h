@@ -1,9 +1,13 @@
 #ifndef __PLOTUTILS_H__
 #define __PLOTUTILS_H__
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 // VT100 Color Codes
@@ -26,6 +30,8 @@
 
 #define NUM_LETTERS 25
 
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
 
 // This struct will represent a circle to plot on the screen with a particular radius.
 struct Circle {
@@ -48,12 +54,61 @@ static int YRange = 4;
 struct Circle Main;
 
 
+// Frame Buffer:
+// Drawing (PlotChar, and everything built on it) only updates an in-memory
+// grid of cells: the back buffer. PresentFrame() compares it with what is on
+// the terminal (the front buffer), and sends just the cells which changed, in
+// a single write(). So a frame costs one system call, and clearing and
+// redrawing something which didn't move costs nothing.
+#define MAX_COLS 320
+#define MAX_ROWS 120
+#define FRAME_OUTPUT_SIZE 65536
+
+struct Cell {
+  char Char;
+  char Color;
+};
+
+static struct Cell BackBuffer[MAX_ROWS][MAX_COLS];
+static struct Cell FrontBuffer[MAX_ROWS][MAX_COLS];
+
+// Escape sequences of the frame being presented.
+static char FrameOutput[FRAME_OUTPUT_SIZE];
+static int FrameOutputLen;
+
+// Output Encoder:
+// The terminal's cursor position and text color are tracked (across frames),
+// so a changed cell only costs the escape sequences it needs: no color
+// change if the color is already set (a blank needs none), nothing to move
+// the cursor along a horizontal run, and otherwise the shortest of
+// rewriting the cells in between, a relative move within the row, or an
+// absolute move. Anything else which moves the cursor or sets the color
+// (e.g., SetCursorAt) must call ForgetTerminalState().
+//
+// ENCODE_PER_CELL instead sends every changed cell on its own (color,
+// position, character and a color reset), as a baseline.
+#define ENCODE_MINIMAL 0
+#define ENCODE_PER_CELL 1
+
+static int FrameEncoding = ENCODE_MINIMAL;
+static int CursorX; // 1 based; 0: unknown
+static int CursorY;
+static int CurrentColor; // 0: unknown
+
+void ForgetTerminalState() {
+  CursorX = 0;
+  CursorY = 0;
+  CurrentColor = 0;
+}
+
+
 /* BEGIN VT100 Helper Functions */
 
 // Set Color of Text.
 void SetTextColor(int Color) {
   printf("\e[%dm", Color);
   fflush(stdout);
+  ForgetTerminalState();
 }
 
 
@@ -61,6 +116,7 @@ void SetTextColor(int Color) {
 void ResetTerminal() {
   printf("\ec");
   fflush(stdout);
+  ForgetTerminalState();
 }
 
 // Sets the cursor at the X (i.e., col) and Y (i.e., row) of the
@@ -68,13 +124,157 @@ void ResetTerminal() {
 void SetCursorAt(int X, int Y) {
   printf("\e[%d;%dH", Y, X);
   fflush(stdout);
+  ForgetTerminalState();
 }
 
 // Provided with a coordinate (X,Y), a Color (e.g., color code for blue) 
-// and Dispchar (e.g., '@'), plot it on the terminal.
+// and Dispchar (e.g., '@'), plot it in the next frame (see PresentFrame).
+// Coordinates outside of the terminal are ignored.
 void PlotChar(int X, int Y, char Color, char Dispchar) {
-  printf("\e[%2dm\e[%d;%dH%c\e[0m", Color, Y, X, Dispchar);
+  if (X < 1 || Y < 1 || X > XRange || Y > YRange)
+    return;
+  // A blank looks the same in any color.
+  if (Dispchar == ' ')
+    Color = BLACK;
+  BackBuffer[Y - 1][X - 1].Char = Dispchar;
+  BackBuffer[Y - 1][X - 1].Color = Color;
+}
+
+// Set every cell of a frame buffer to a blank.
+void BlankCells(struct Cell Buffer[MAX_ROWS][MAX_COLS]) {
+  int X, Y;
+  for (Y = 0; Y < MAX_ROWS; ++Y) {
+    for (X = 0; X < MAX_COLS; ++X) {
+      Buffer[Y][X].Char = ' ';
+      Buffer[Y][X].Color = BLACK;
+    }
+  }
+}
+
+// Clear the next frame (the terminal is only updated by PresentFrame).
+void ClearFrame() { BlankCells(BackBuffer); }
+
+// Write out the escape sequences queued so far.
+void FlushFrameOutput() {
+  int Written = 0;
+  int Status;
+
+  while (Written < FrameOutputLen) {
+    Status = write(STDOUT_FILENO, FrameOutput + Written,
+                   FrameOutputLen - Written);
+    if (Status < 0 && errno == EINTR)
+      continue;
+    if (Status <= 0)
+      break;
+    Written += Status;
+  }
+  FrameOutputLen = 0;
+}
+
+// Make room for (at least) 32 more bytes of output.
+void ReserveFrameOutput() {
+  if (FrameOutputLen + 32 > FRAME_OUTPUT_SIZE)
+    FlushFrameOutput();
+}
+
+// Number of decimal digits in N (> 0).
+int Digits(int N) {
+  int Count = 1;
+  while (N >= 10) {
+    N /= 10;
+    Count++;
+  }
+  return Count;
+}
+
+// Queue the character of Cell at the cursor (setting its color first, if
+// needed), which then moves right.
+void QueueChar(const struct Cell *Cell) {
+  ReserveFrameOutput();
+  if (Cell->Char != ' ' && Cell->Color != CurrentColor) {
+    FrameOutputLen += snprintf(FrameOutput + FrameOutputLen, 32, "\e[%dm",
+                               Cell->Color);
+    CurrentColor = Cell->Color;
+  }
+  FrameOutput[FrameOutputLen++] = Cell->Char;
+  // At the last column the cursor stays put, with a pending wrap.
+  CursorX = CursorX && CursorX < XRange ? CursorX + 1 : 0;
+}
+
+// Queue the shortest way to move the cursor to (X, Y).
+void QueueMove(int X, int Y) {
+  int Gap = X - CursorX;
+  int Distance = abs(Gap);
+  int Relative;
+  int i;
+
+  if (CursorX == X && CursorY == Y)
+    return;
+  ReserveFrameOutput();
+  if (!CursorX || CursorY != Y) {
+    FrameOutputLen +=
+        snprintf(FrameOutput + FrameOutputLen, 32, "\e[%d;%dH", Y, X);
+    CursorX = X;
+    CursorY = Y;
+    return;
+  }
+
+  // Within the row: "\e[C" moves one cell, "\e[NC" N cells. Rewriting the
+  // (unchanged) cells in between is cheaper for short gaps, if that needs no
+  // color change.
+  Relative = Distance == 1 ? 3 : 3 + Digits(Distance);
+  if (Gap > 0 && Gap < Relative) {
+    for (i = CursorX - 1; i < X - 1; ++i) {
+      if (FrontBuffer[Y - 1][i].Char != ' ' &&
+          FrontBuffer[Y - 1][i].Color != CurrentColor)
+        break;
+    }
+    if (i == X - 1) {
+      for (i = CursorX - 1; i < X - 1; ++i)
+        QueueChar(&FrontBuffer[Y - 1][i]);
+      return;
+    }
+  }
+  if (Distance == 1)
+    FrameOutputLen += snprintf(FrameOutput + FrameOutputLen, 32, "\e[%c",
+                               Gap > 0 ? 'C' : 'D');
+  else
+    FrameOutputLen += snprintf(FrameOutput + FrameOutputLen, 32, "\e[%d%c",
+                               Distance, Gap > 0 ? 'C' : 'D');
+  CursorX = X;
+}
+
+// Queue the escape sequences which draw Cell at (X, Y).
+void QueueCell(int X, int Y, const struct Cell *Cell) {
+  if (FrameEncoding == ENCODE_PER_CELL) {
+    ReserveFrameOutput();
+    FrameOutputLen += snprintf(FrameOutput + FrameOutputLen, 32,
+                               "\e[%2dm\e[%d;%dH%c\e[0m", Cell->Color, Y, X,
+                               Cell->Char);
+    ForgetTerminalState();
+    return;
+  }
+  QueueMove(X, Y);
+  QueueChar(Cell);
+}
+
+// Show the frame drawn since the last call: every cell which differs from
+// what is on the terminal is sent, in a single write().
+void PresentFrame() {
+  int X, Y;
+
+  // Anything printf'd directly must go out first.
   fflush(stdout);
+  for (Y = 0; Y < YRange; ++Y) {
+    for (X = 0; X < XRange; ++X) {
+      if (BackBuffer[Y][X].Char == FrontBuffer[Y][X].Char &&
+          BackBuffer[Y][X].Color == FrontBuffer[Y][X].Color)
+        continue;
+      QueueCell(X + 1, Y + 1, &BackBuffer[Y][X]);
+      FrontBuffer[Y][X] = BackBuffer[Y][X];
+    }
+  }
+  FlushFrameOutput();
 }
 
 // Clear the screen
@@ -112,61 +312,328 @@ void ShowCursor() {
 //
 //      TIOCGWINSZ     struct winsize *argp
 //             Get window size.
+//
+// (Not a terminal: assume 80x24. The frame buffers hold at most
+// MAX_COLS x MAX_ROWS.)
 void GetTerminalSize() {
   struct winsize w;
-  ioctl(0, TIOCGWINSZ, &w);
-  XRange = w.ws_col;
-  YRange = w.ws_row;
+  if (ioctl(0, TIOCGWINSZ, &w) == -1 || !w.ws_col || !w.ws_row) {
+    w.ws_col = 80;
+    w.ws_row = 24;
+  }
+  XRange = w.ws_col < MAX_COLS ? w.ws_col : MAX_COLS;
+  YRange = w.ws_row < MAX_ROWS ? w.ws_row : MAX_ROWS;
 }
 
 // The terminal will be cleared, and the cursor
-// will be hidden.
+// will be hidden. Both frame buffers start out blank, like the terminal.
 void InitializeTerminal() {
   Main.Valid = 0;
   HideCursor();
   ClearTerminal();
   GetTerminalSize();
+  ForgetTerminalState();
+  BlankCells(BackBuffer);
+  BlankCells(FrontBuffer);
 }
 
 /* END VT100 Helper Functions */
 
 
 
-// Follows Bresenham's Algorithm (this ver. is valid for ALL quadrants.)
-void GeneralizedPlotLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
-  // Absolute change in X
-  int dX = abs(X1 - X0);
-  // Change in slope for X
-  int sX = X0 < X1 ? 1 : -1;
-
-  // Absolute change in Y
-  int dY = -abs(Y1 - Y0);
-  // Change in slop for Y
-  int sY = Y0 < Y1 ? 1 : -1;
+// Frame Pacing:
+// The terminal is redrawn at a fixed rate, however fast (or slowly) samples
+// arrive: each frame, a program takes in every sample that arrived since the
+// last one, draws its latest state, presents it, then sleeps in
+// WaitForFrame() until the next frame is due. Deadlines are absolute
+// (CLOCK_MONOTONIC), so the time spent drawing doesn't slow the rate down,
+// and a frame which runs late skips the deadlines it missed instead of
+// drawing a burst of frames to catch up.
+#define FRAME_RATE 30 // Frames per second
+#define NS_PER_SEC 1000000000ULL
+
+struct FramePacer {
+  uint64_t NextNs;   // When the next frame is due (CLOCK_MONOTONIC, ns)
+  uint64_t PeriodNs; // Time between frames
+  uint64_t Frames;   // Frames waited for so far
+  uint64_t Skipped;  // Deadlines missed because a frame ran late
+};
+
+uint64_t FrameClockNs() {
+  struct timespec T;
+  clock_gettime(CLOCK_MONOTONIC, &T);
+  return (uint64_t)T.tv_sec * NS_PER_SEC + T.tv_nsec;
+}
+
+// Pace frames at Rate frames per second, starting one period from now.
+void StartFramePacer(struct FramePacer *Pacer, int Rate) {
+  Pacer->PeriodNs = NS_PER_SEC / (Rate > 0 ? Rate : FRAME_RATE);
+  Pacer->NextNs = FrameClockNs() + Pacer->PeriodNs;
+  Pacer->Frames = 0;
+  Pacer->Skipped = 0;
+}
+
+// Sleep until the next frame is due. A signal (e.g., SIGINT) ends the sleep
+// early, without consuming the deadline.
+void WaitForFrame(struct FramePacer *Pacer) {
+  struct timespec Deadline;
+  uint64_t Now;
+
+  Deadline.tv_sec = Pacer->NextNs / NS_PER_SEC;
+  Deadline.tv_nsec = Pacer->NextNs % NS_PER_SEC;
+  if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, NULL))
+    return;
+  ++Pacer->Frames;
+  Pacer->NextNs += Pacer->PeriodNs;
+  Now = FrameClockNs();
+  if (Now >= Pacer->NextNs) {
+    Pacer->Skipped += (Now - Pacer->NextNs) / Pacer->PeriodNs + 1;
+    Pacer->NextNs = Now + Pacer->PeriodNs;
+  }
+}
+
+
+
+// Sprites:
+// A shape (a circle of some radius, or a line of some extent) is drawn from
+// a sprite: the cells it covers as offsets from its origin, deduplicated and
+// merged into horizontal spans (sorted by row). Drawing or erasing a shape
+// is then a single pass over its spans, clipped to the terminal, instead of
+// rerunning the rasterization (which plots the same cell several times).
+//
+// The circles part3 and part4 draw (radius 3 and 4) are built in; other
+// radii are rasterized on first use and kept, and lines are kept in a small
+// cache keyed by their extent.
+struct Span {
+  short DY;  // Row offset
+  short DX;  // Column offset of the first cell
+  short Len; // Number of cells
+};
+
+struct Sprite {
+  const struct Span *Spans;
+  int Count;
+};
+
+// Midpoint circles, as rasterized by RasterCircle.
+static const struct Span CircleSpans3[] = {
+    {-3, -1, 3}, {-2, -2, 1}, {-2, 2, 1}, {-1, -3, 1}, {-1, 3, 1}, {0, -3, 1},
+    {0, 3, 1},   {1, -3, 1},  {1, 3, 1},  {2, -2, 1},  {2, 2, 1},  {3, -1, 3}};
+static const struct Span CircleSpans4[] = {
+    {-4, -1, 3}, {-3, -2, 1}, {-3, 2, 1}, {-2, -3, 1}, {-2, 3, 1}, {-1, -4, 1},
+    {-1, 4, 1},  {0, -4, 1},  {0, 4, 1},  {1, -4, 1},  {1, 4, 1},  {2, -3, 1},
+    {2, 3, 1},   {3, -2, 1},  {3, 2, 1},  {4, -1, 3}};
+static const struct Sprite CircleSprite3 = {CircleSpans3,
+                                            ARRAY_LEN(CircleSpans3)};
+static const struct Sprite CircleSprite4 = {CircleSpans4,
+                                            ARRAY_LEN(CircleSpans4)};
+
+// Largest radius kept once rasterized, and largest drawn at all.
+#define MAX_CACHED_RADIUS 32
+#define MAX_RADIUS MAX_COLS
+// Bound on the cells of a circle of radius R (8 octants, plus overshoot).
+#define CIRCLE_CELLS(R) (8 * ((R) + 2))
+
+#define LINE_CACHE_SIZE 16
+
+struct CachedLine {
+  int DX;
+  int DY;
+  int Valid;
+  struct Sprite Sprite;
+  struct Span Spans[MAX_ROWS + 1];
+};
+
+static struct Span CircleCache[MAX_CACHED_RADIUS + 1]
+                              [CIRCLE_CELLS(MAX_CACHED_RADIUS)];
+static struct Sprite CircleSprites[MAX_CACHED_RADIUS + 1];
+static struct CachedLine LineCache[LINE_CACHE_SIZE];
+
+// Scratch space for rasterizing (any shape fits: at most one point per
+// cell of a MAX_COLS x MAX_ROWS terminal, or per cell of a circle).
+#define MAX_POINTS CIRCLE_CELLS(MAX_RADIUS)
+static struct Span Points[MAX_POINTS];
+static struct Span Uncached[MAX_POINTS];
+
+int CompareSpans(const void *A, const void *B) {
+  const struct Span *SA = A;
+  const struct Span *SB = B;
+  if (SA->DY != SB->DY)
+    return SA->DY - SB->DY;
+  return SA->DX - SB->DX;
+}
+
+// Sort Count points (spans of length 1), drop duplicates, and merge
+// neighbours into spans. Returns the number of spans written to Spans.
+int BuildSpans(struct Span *Points, int Count, struct Span *Spans) {
+  int Spanned = 0;
+  int i;
+  struct Span *Last;
+
+  qsort(Points, Count, sizeof(struct Span), CompareSpans);
+  for (i = 0; i < Count; ++i) {
+    Last = Spanned ? &Spans[Spanned - 1] : NULL;
+    if (Last && Last->DY == Points[i].DY &&
+        Points[i].DX < Last->DX + Last->Len)
+      continue; // Duplicate.
+    if (Last && Last->DY == Points[i].DY &&
+        Points[i].DX == Last->DX + Last->Len) {
+      Last->Len++;
+      continue;
+    }
+    Spans[Spanned++] = Points[i];
+  }
+  return Spanned;
+}
+
+// Add the point (X, Y) in all 8 octants.
+int AddOctants(struct Span *Points, int Count, int X, int Y) {
+  const int Signs[4][2] = {{1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+  int i;
+
+  for (i = 0; i < 4; ++i) {
+    Points[Count++] = (struct Span){Signs[i][1] * Y, Signs[i][0] * X, 1};
+    Points[Count++] = (struct Span){Signs[i][1] * X, Signs[i][0] * Y, 1};
+  }
+  return Count;
+}
+
+// Rasterize a circle of radius R (0 - MAX_RADIUS) around the origin into
+// Spans, following the midpoint circle algorithm.
+// Returns the number of spans.
+int RasterCircle(int R, struct Span *Spans) {
+  int X = 0;
+  int Y = R;
+  int D = 3 - (2 * R);
+  int Count;
+
+  Count = AddOctants(Points, 0, X, Y);
+  while (Y >= X) {
+    X++;
+    if (D > 0) {
+      Y--;
+      D = D + 4 * (X - Y) + 10;
+    } else {
+      D = D + 4 * X + 6;
+    }
+    Count = AddOctants(Points, Count, X, Y);
+  }
+  return BuildSpans(Points, Count, Spans);
+}
+
+// Rasterize a line from the origin to (DX, DY) into Spans, following
+// Bresenham's Algorithm (this ver. is valid for ALL quadrants.)
+// |DX| and |DY| must be less than MAX_POINTS. Returns the number of spans.
+int RasterLine(int DX, int DY, struct Span *Spans) {
+  int X = 0;
+  int Y = 0;
+  // Absolute change in X, and slope for X
+  int dX = abs(DX);
+  int sX = 0 < DX ? 1 : -1;
+  // Absolute change in Y, and slope for Y
+  int dY = -abs(DY);
+  int sY = 0 < DY ? 1 : -1;
   // Error
   int E = dX + dY;
   int DoubleE;
+  int Count = 0;
 
   for (;;) {
-    PlotChar(X0, Y0, Color, Sym);
+    Points[Count++] = (struct Span){Y, X, 1};
     DoubleE = E << 1;
     /* Check if the Error between X and Y is > dX */
     if (DoubleE >= dY) {
-      if (X0 == X1)
+      if (X == DX)
         break;
       E += dY;
-      X0 += sX;
+      X += sX;
     }
     /* Check if the Error between X and Y is > dY */
     if (DoubleE <= dX) {
-      if (Y0 == Y1)
+      if (Y == DY)
         break;
       E += dX;
-      Y0 += sY;
+      Y += sY;
+    }
+  }
+  return BuildSpans(Points, Count, Spans);
+}
+
+// The sprite of a circle of radius R, or NULL if R is out of range.
+const struct Sprite *CircleSprite(int R) {
+  static struct Sprite Sprite;
+
+  if (R == 3)
+    return &CircleSprite3;
+  if (R == 4)
+    return &CircleSprite4;
+  if (R < 0 || R > MAX_RADIUS)
+    return NULL;
+  if (R > MAX_CACHED_RADIUS) {
+    Sprite.Spans = Uncached;
+    Sprite.Count = RasterCircle(R, Uncached);
+    return &Sprite;
+  }
+  if (!CircleSprites[R].Spans) {
+    CircleSprites[R].Count = RasterCircle(R, CircleCache[R]);
+    CircleSprites[R].Spans = CircleCache[R];
+  }
+  return &CircleSprites[R];
+}
+
+// The sprite of a line from the origin to (DX, DY), or NULL if it's larger
+// than the terminal can be.
+const struct Sprite *LineSprite(int DX, int DY) {
+  struct CachedLine *Line =
+      &LineCache[(unsigned int)(DX * 31 + DY) % LINE_CACHE_SIZE];
+
+  if (abs(DX) >= MAX_COLS || abs(DY) >= MAX_ROWS)
+    return NULL;
+  if (!Line->Valid || Line->DX != DX || Line->DY != DY) {
+    Line->DX = DX;
+    Line->DY = DY;
+    Line->Valid = 1;
+    Line->Sprite.Spans = Line->Spans;
+    Line->Sprite.Count = RasterLine(DX, DY, Line->Spans);
+  }
+  return &Line->Sprite;
+}
+
+// Draw a sprite with its origin at (X, Y), in one pass over its spans.
+// Cells outside of the terminal are skipped.
+void DrawSprite(const struct Sprite *Sprite, int X, int Y, int Color,
+                char Sym) {
+  const struct Span *Span;
+  int Row, First, Last;
+  int i;
+
+  if (!Sprite)
+    return;
+  // A blank looks the same in any color.
+  if (Sym == ' ')
+    Color = BLACK;
+  for (i = 0; i < Sprite->Count; ++i) {
+    Span = &Sprite->Spans[i];
+    Row = Y + Span->DY;
+    if (Row < 1 || Row > YRange)
+      continue;
+    First = X + Span->DX;
+    Last = First + Span->Len - 1;
+    if (First < 1)
+      First = 1;
+    if (Last > XRange)
+      Last = XRange;
+    for (; First <= Last; ++First) {
+      BackBuffer[Row - 1][First - 1].Char = Sym;
+      BackBuffer[Row - 1][First - 1].Color = Color;
     }
   }
 }
 
+void GeneralizedPlotLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
+  DrawSprite(LineSprite(X1 - X0, Y1 - Y0), X0, Y0, Color, Sym);
+}
+
 
 // NEW: Circle Drawing Utilities:
 // We present two new APIs to draw circles on the terminal with Assignment 7.
@@ -174,33 +641,8 @@ void GeneralizedPlotLine(int X0, int Y0, int X1, int Y1, int Color, char Sym) {
 // (1) PlotCircle 
 //   or
 // (2) ClearCircle
-void CircleDrawUtil(int XC, int YC, int X, int Y, int Color, char Sym) {
-  PlotChar(XC + X, YC + Y, Color, Sym);
-  PlotChar(XC - X, YC + Y, Color, Sym);
-  PlotChar(XC + X, YC - Y, Color, Sym);
-  PlotChar(XC - X, YC - Y, Color, Sym);
-  PlotChar(XC + Y, YC + X, Color, Sym);
-  PlotChar(XC - Y, YC + X, Color, Sym);
-  PlotChar(XC + Y, YC - X, Color, Sym);
-  PlotChar(XC - Y, YC - X, Color, Sym);
-}
-
 void GeneralizedCircle(int XC, int YC, int R, int Color, char Sym) {
-  int X = 0;
-  int Y = R;
-  int D = 3 - (2*R);
-
-  CircleDrawUtil(XC, YC, X, Y, Color, Sym);
-  while (Y >= X) {         
-    X++;
-    if (D > 0) {
-      Y--; 
-      D = D + 4 * (X - Y) + 10;
-    } else {
-      D = D + 4 * X + 6;
-    }
-    CircleDrawUtil(XC, YC, X, Y, Color, Sym);
-  }
+  DrawSprite(CircleSprite(R), XC, YC, Color, Sym);
 }
 
 void PlotCircle(int X, int Y, int R, int Color) {
@@ -0,0 +1,625 @@
+#ifndef __ADXL345_SIM_H__
+#define __ADXL345_SIM_H__
+
+// ADXL345 Simulator:
+// A register level model of the HPS I2C0 controller (Synopsys DesignWare)
+// with an ADXL345 on the bus, so the ADXL345_* routines can run on any Linux
+// host (no DE1-SoC). Build with -DADXL345_SIM: ADXL345.h then does every
+// I2C0 register access through ADXL345Sim_Read/ADXL345Sim_Write, and the
+// /dev/mem helpers of fileio.h hand out plain memory.
+//
+// I2C0: DATA_CMD (with the RESTART and READ command bits), RXFLR, TXFLR,
+//   STATUS, ENABLE/ENABLE_STATUS and TX_ABRT (a target address other than
+//   the ADXL345's is not acknowledged). Each byte on the wire takes 22.5 us
+//   (400 kHz): commands queue up behind each other, STATUS shows the master
+//   busy until the last one is out, and a byte read only reaches the RX FIFO
+//   once it has been clocked in.
+// ADXL345: every register, with its reset value. While measuring, a sample
+//   is taken every output data rate period, offset by OFSX/OFSY/OFSZ and
+//   formatted per DATA_FORMAT (range, full resolution). DATA_READY,
+//   OVERRUN, the FIFO (bypass, FIFO and stream modes, WATERMARK) and
+//   single/double tap, activity/inactivity and free fall detection are
+//   modeled (the latter with simplified timing: see ADXL345Sim_Detect).
+//
+// The acceleration comes from a waveform (in mg, of the time since the
+// simulator started): by default a board lying flat and still for 5 seconds
+// (long enough to calibrate), which then slowly tilts back and forth, with
+// a tap every 2 seconds. If
+// ADXL345_SIM_WAVE names a file, each of its lines ("X Y Z", in mg) is
+// played back as one sample (looping at the end), e.g. a capture of
+// /dev/accel converted to mg. ADXL345Sim_SetWaveform installs any other
+// source.
+//
+// Time is CLOCK_MONOTONIC, so samples arrive at the real output data rate.
+// With ADXL345_SIM_CLOCK=virtual, time only advances when the program
+// waits, with ADXL345Sim_Sleep (or a little with each ADXL345Sim_Relax of a
+// spin loop): runs are deterministic, and as fast as the host allows.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "address_map_arm.h"
+
+// ADXL345 registers (and bits) the model gives a meaning to.
+#define SIM_REG_DEVID 0x00
+#define SIM_REG_THRESH_TAP 0x1D
+#define SIM_REG_OFSX 0x1E
+#define SIM_REG_DUR 0x21
+#define SIM_REG_LATENT 0x22
+#define SIM_REG_WINDOW 0x23
+#define SIM_REG_THRESH_ACT 0x24
+#define SIM_REG_THRESH_INACT 0x25
+#define SIM_REG_TIME_INACT 0x26
+#define SIM_REG_ACT_INACT_CTL 0x27
+#define SIM_REG_THRESH_FF 0x28
+#define SIM_REG_TIME_FF 0x29
+#define SIM_REG_TAP_AXES 0x2A
+#define SIM_REG_ACT_TAP_STATUS 0x2B
+#define SIM_REG_BW_RATE 0x2C
+#define SIM_REG_POWER_CTL 0x2D
+#define SIM_REG_INT_ENABLE 0x2E
+#define SIM_REG_INT_SOURCE 0x30
+#define SIM_REG_DATA_FORMAT 0x31
+#define SIM_REG_DATAX0 0x32
+#define SIM_REG_DATAZ1 0x37
+#define SIM_REG_FIFO_CTL 0x38
+#define SIM_REG_FIFO_STATUS 0x39
+#define SIM_REGS 0x40
+
+#define SIM_INT_OVERRUN 0x01
+#define SIM_INT_WATERMARK 0x02
+#define SIM_INT_FREEFALL 0x04
+#define SIM_INT_INACTIVITY 0x08
+#define SIM_INT_ACTIVITY 0x10
+#define SIM_INT_DOUBLETAP 0x20
+#define SIM_INT_SINGLETAP 0x40
+#define SIM_INT_DATAREADY 0x80
+// Cleared by reading INT_SOURCE (the others track the data registers).
+#define SIM_INT_LATCHED 0x7C
+
+#define SIM_FIFO_DEPTH 32
+#define SIM_I2C_FIFO_DEPTH 64
+#define SIM_I2C_BYTE_NS 22500
+#define SIM_RELAX_NS 100
+#define SIM_ADXL345_ADDRESS 0x53
+
+// Bits of the simulated I2C0 registers.
+#define SIM_CMD_READ 0x100
+#define SIM_CMD_RESTART 0x400
+#define SIM_STATUS_TFE 0x04
+#define SIM_STATUS_RFNE 0x08
+#define SIM_STATUS_MST_ACTIVITY 0x20
+#define SIM_INTR_TX_ABRT 0x40
+#define SIM_ABRT_7B_ADDR_NOACK 0x01
+
+typedef void (*ADXL345SimWaveform)(uint64_t Ns, int MG[3]);
+
+struct ADXL345SimState {
+  // I2C0 controller
+  unsigned int Enable;
+  unsigned int Tar;
+  unsigned int RawIntr;
+  unsigned int AbrtSource;
+  uint8_t Rx[SIM_I2C_FIFO_DEPTH];
+  uint64_t RxReadyNs[SIM_I2C_FIFO_DEPTH]; // When each byte is clocked in
+  unsigned int RxHead;
+  unsigned int RxCount;
+  uint8_t Pointer;    // The ADXL345's register address pointer
+  bool Addressing;    // The next byte written is a register address
+  uint64_t BusBytes;  // Bytes which went out on the wire
+  uint64_t BusyUntilNs; // When the last queued byte is out
+  uint64_t Transfers; // START/RESTART conditions
+
+  // ADXL345
+  uint8_t Regs[SIM_REGS];
+  int16_t Fifo[SIM_FIFO_DEPTH][3]; // [0] is in DATAX0 - DATAZ1
+  unsigned int FifoCount;
+  uint64_t NextSampleNs; // When the next sample is taken (while measuring)
+  uint64_t Samples;      // Samples taken
+
+  // Event detection
+  int LastMG[3];
+  int ActRefMG[3];
+  uint64_t LastTapNs;
+  uint64_t QuietSinceNs;
+  uint64_t FallSinceNs;
+  bool Inactive;
+
+  // Time and acceleration
+  bool Virtual;
+  uint64_t VirtualNs;
+  uint64_t StartNs;
+  ADXL345SimWaveform Waveform;
+  FILE *WaveFile;
+  bool Initialized;
+};
+
+static struct ADXL345SimState ADXL345Sim;
+
+static uint64_t ADXL345Sim_Now(void) {
+  struct timespec Now;
+
+  if (ADXL345Sim.Virtual)
+    return ADXL345Sim.VirtualNs;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+// Let Ns of (virtual) time pass. Wall clock time passes by itself.
+void ADXL345Sim_Sleep(uint64_t Ns) {
+  struct timespec Delay = {Ns / 1000000000ULL, Ns % 1000000000ULL};
+
+  if (ADXL345Sim.Virtual)
+    ADXL345Sim.VirtualNs += Ns;
+  else
+    nanosleep(&Delay, NULL);
+}
+
+// One iteration of a spin loop: a few bus clock cycles of virtual time.
+void ADXL345Sim_Relax(void) {
+  if (ADXL345Sim.Virtual)
+    ADXL345Sim.VirtualNs += SIM_RELAX_NS;
+}
+
+// The default waveform: lying flat (+1 g on Z) with a little noise. After 5
+// seconds it tilts back and forth by up to +/- 400 mg on X and Y (with
+// periods of 8 and 12 seconds), and gets a 3.5 g spike on Z (a tap) for
+// 10 ms every 2 seconds.
+static void ADXL345Sim_DefaultWaveform(uint64_t Ns, int MG[3]) {
+  static uint32_t Noise = 1;
+  uint64_t Ms = Ns / 1000000;
+  int i;
+
+  MG[0] = MG[1] = 0;
+  MG[2] = 1000;
+  if (Ms >= 5000) {
+    // Triangle waves, so no floating point is needed.
+    Ms -= 5000;
+    MG[0] = (int)(Ms % 4000) / 5 - 400;
+    if (Ms % 8000 >= 4000)
+      MG[0] = -MG[0];
+    MG[1] = (int)(Ms % 6000) * 2 / 15 - 400;
+    if (Ms % 12000 >= 6000)
+      MG[1] = -MG[1];
+    if (Ms % 2000 < 10)
+      MG[2] += 3500;
+  }
+  for (i = 0; i < 3; i++) {
+    Noise = Noise * 1103515245 + 12345;
+    MG[i] += (int)((Noise >> 16) % 9) - 4;
+  }
+}
+
+// Play back a recorded waveform, one "X Y Z" line (in mg) per sample.
+static void ADXL345Sim_FileWaveform(uint64_t Ns, int MG[3]) {
+  char Line[128];
+  int Tries;
+
+  for (Tries = 0; Tries < 2; Tries++) {
+    while (fgets(Line, sizeof(Line), ADXL345Sim.WaveFile)) {
+      if (sscanf(Line, "%d %d %d", &MG[0], &MG[1], &MG[2]) == 3)
+        return;
+    }
+    rewind(ADXL345Sim.WaveFile);
+  }
+  MG[0] = MG[1] = MG[2] = 0;
+}
+
+// Use Waveform as the source of acceleration (NULL for the default).
+void ADXL345Sim_SetWaveform(ADXL345SimWaveform Waveform) {
+  ADXL345Sim.Waveform = Waveform ? Waveform : ADXL345Sim_DefaultWaveform;
+}
+
+// Power on: every register takes its reset value.
+void ADXL345Sim_Reset(void) {
+  ADXL345SimWaveform Waveform = ADXL345Sim.Waveform;
+  FILE *WaveFile = ADXL345Sim.WaveFile;
+  bool Virtual = ADXL345Sim.Virtual;
+  uint64_t VirtualNs = ADXL345Sim.VirtualNs;
+  uint64_t StartNs = ADXL345Sim.StartNs;
+
+  memset(&ADXL345Sim, 0, sizeof(ADXL345Sim));
+  ADXL345Sim.Waveform = Waveform;
+  ADXL345Sim.WaveFile = WaveFile;
+  ADXL345Sim.Virtual = Virtual;
+  ADXL345Sim.VirtualNs = VirtualNs;
+  ADXL345Sim.StartNs = StartNs;
+  ADXL345Sim.Regs[SIM_REG_DEVID] = 0xE5;
+  ADXL345Sim.Regs[SIM_REG_BW_RATE] = 0x0A;
+  ADXL345Sim.Regs[SIM_REG_INT_SOURCE] = SIM_INT_WATERMARK;
+  ADXL345Sim.Initialized = true;
+}
+
+// Set up from the environment (on first use).
+static void ADXL345Sim_Init(void) {
+  const char *Clock = getenv("ADXL345_SIM_CLOCK");
+  const char *Wave = getenv("ADXL345_SIM_WAVE");
+
+  ADXL345Sim.Virtual = Clock && strcmp(Clock, "virtual") == 0;
+  ADXL345Sim.VirtualNs = 1000000000ULL;
+  ADXL345Sim.StartNs = ADXL345Sim_Now();
+  ADXL345Sim.Waveform = ADXL345Sim_DefaultWaveform;
+  if (Wave) {
+    ADXL345Sim.WaveFile = fopen(Wave, "r");
+    if (ADXL345Sim.WaveFile)
+      ADXL345Sim.Waveform = ADXL345Sim_FileWaveform;
+    else
+      fprintf(stderr, "ADXL345 simulator: can't open %s\n", Wave);
+  }
+  ADXL345Sim_Reset();
+}
+
+static uint64_t ADXL345Sim_PeriodNs(void) {
+  // 3200 Hz at rate code 0x0F, halving with every step down.
+  return 312500ULL << (0x0F - (ADXL345Sim.Regs[SIM_REG_BW_RATE] & 0x0F));
+}
+
+static bool ADXL345Sim_Measuring(void) {
+  return ADXL345Sim.Regs[SIM_REG_POWER_CTL] & 0x08;
+}
+
+// Set the (enabled) event flags in INT_SOURCE.
+static void ADXL345Sim_Raise(uint8_t Events) {
+  ADXL345Sim.Regs[SIM_REG_INT_SOURCE] |=
+      Events & ADXL345Sim.Regs[SIM_REG_INT_ENABLE];
+}
+
+// Event detection, on each new sample (in mg, before the offsets):
+//  tap: an enabled axis jumps by more than THRESH_TAP since the previous
+//       sample (DUR isn't checked). A second tap after LATENT and within
+//       WINDOW of the first is a double tap.
+//  activity/inactivity: an enabled axis moves away from the reference
+//       (AC coupled) or zero (DC coupled) by more than THRESH_ACT; every
+//       enabled axis stays within THRESH_INACT of it for TIME_INACT.
+//  free fall: every axis stays below THRESH_FF for TIME_FF.
+static void ADXL345Sim_Detect(const int MG[3], uint64_t Ns) {
+  uint8_t *Regs = ADXL345Sim.Regs;
+  uint8_t Ctl = Regs[SIM_REG_ACT_INACT_CTL];
+  int Tap = Regs[SIM_REG_THRESH_TAP] * 62500 / 1000;
+  int Act = Regs[SIM_REG_THRESH_ACT] * 62500 / 1000;
+  int Inact = Regs[SIM_REG_THRESH_INACT] * 62500 / 1000;
+  int FreeFall = Regs[SIM_REG_THRESH_FF] * 62500 / 1000;
+  uint64_t Latent = Regs[SIM_REG_LATENT] * 1250000ULL;
+  uint64_t Window = Regs[SIM_REG_WINDOW] * 1250000ULL;
+  bool Tapped = false;
+  bool Active = false;
+  bool Quiet = true;
+  bool Falling = true;
+  int Ref;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    // The X axis bits are 0x04 in TAP_AXES, 0x40 (activity) and 0x04
+    // (inactivity) in ACT_INACT_CTL; Y and Z follow.
+    if ((Regs[SIM_REG_TAP_AXES] & (0x04 >> i)) && Tap &&
+        abs(MG[i]) - abs(ADXL345Sim.LastMG[i]) > Tap)
+      Tapped = true;
+    Ref = (Ctl & 0x80) ? ADXL345Sim.ActRefMG[i] : 0;
+    if ((Ctl & (0x40 >> i)) && Act && abs(MG[i] - Ref) > Act)
+      Active = true;
+    Ref = (Ctl & 0x08) ? ADXL345Sim.ActRefMG[i] : 0;
+    if ((Ctl & (0x04 >> i)) && abs(MG[i] - Ref) > Inact)
+      Quiet = false;
+    if (abs(MG[i]) >= FreeFall)
+      Falling = false;
+  }
+
+  if (Tapped) {
+    if (ADXL345Sim.LastTapNs && Ns - ADXL345Sim.LastTapNs > Latent &&
+        Ns - ADXL345Sim.LastTapNs <= Latent + Window) {
+      ADXL345Sim_Raise(SIM_INT_DOUBLETAP);
+      ADXL345Sim.LastTapNs = 0;
+    } else {
+      ADXL345Sim_Raise(SIM_INT_SINGLETAP);
+      ADXL345Sim.LastTapNs = Ns;
+    }
+  }
+  if (Active) {
+    ADXL345Sim_Raise(SIM_INT_ACTIVITY);
+    memcpy(ADXL345Sim.ActRefMG, MG, sizeof(ADXL345Sim.ActRefMG));
+    ADXL345Sim.Inactive = false;
+  }
+  if (!Quiet || !ADXL345Sim.QuietSinceNs)
+    ADXL345Sim.QuietSinceNs = Ns;
+  if (Quiet && !ADXL345Sim.Inactive &&
+      Ns - ADXL345Sim.QuietSinceNs >=
+          Regs[SIM_REG_TIME_INACT] * 1000000000ULL) {
+    ADXL345Sim_Raise(SIM_INT_INACTIVITY);
+    memcpy(ADXL345Sim.ActRefMG, MG, sizeof(ADXL345Sim.ActRefMG));
+    ADXL345Sim.Inactive = true;
+  }
+  if (!Falling || !ADXL345Sim.FallSinceNs)
+    ADXL345Sim.FallSinceNs = Ns;
+  if (Falling && Ns - ADXL345Sim.FallSinceNs >=
+                     Regs[SIM_REG_TIME_FF] * 5000000ULL)
+    ADXL345Sim_Raise(SIM_INT_FREEFALL);
+  memcpy(ADXL345Sim.LastMG, MG, sizeof(ADXL345Sim.LastMG));
+}
+
+// Convert an acceleration (mg) to output LSBs, per DATA_FORMAT and the
+// offset registers (15.6 mg/LSB). Left justification isn't modeled.
+static int16_t ADXL345Sim_Format(int MG, int8_t Offset) {
+  uint8_t Format = ADXL345Sim.Regs[SIM_REG_DATA_FORMAT];
+  int Range = Format & 0x03;
+  // 3.9 mg/LSB in full resolution, 10 bits over the range otherwise.
+  int MicroGPerLSB = (Format & 0x08) ? 3906 : 3906 << Range;
+  int Max = (Format & 0x08) ? (512 << Range) - 1 : 511;
+  long Value = ((long)MG * 1000 + Offset * 15625L);
+
+  Value = Value >= 0 ? (Value + MicroGPerLSB / 2) / MicroGPerLSB
+                     : (Value - MicroGPerLSB / 2) / MicroGPerLSB;
+  if (Value > Max)
+    Value = Max;
+  if (Value < -Max - 1)
+    Value = -Max - 1;
+  return Value;
+}
+
+// Take one sample at time Ns.
+static void ADXL345Sim_Sample(uint64_t Ns) {
+  uint8_t FifoCtl = ADXL345Sim.Regs[SIM_REG_FIFO_CTL];
+  uint8_t Mode = FifoCtl & 0xC0;
+  int16_t XYZ[3];
+  int MG[3];
+  int i;
+
+  ADXL345Sim.Waveform(Ns - ADXL345Sim.StartNs, MG);
+  ADXL345Sim_Detect(MG, Ns);
+  for (i = 0; i < 3; i++)
+    XYZ[i] = ADXL345Sim_Format(MG[i],
+                               (int8_t)ADXL345Sim.Regs[SIM_REG_OFSX + i]);
+  ADXL345Sim.Samples++;
+
+  if (Mode == 0x00) {
+    // Bypass: a sample which wasn't read is overwritten.
+    if (ADXL345Sim.FifoCount)
+      ADXL345Sim.Regs[SIM_REG_INT_SOURCE] |= SIM_INT_OVERRUN;
+    memcpy(ADXL345Sim.Fifo[0], XYZ, sizeof(XYZ));
+    ADXL345Sim.FifoCount = 1;
+  } else if (ADXL345Sim.FifoCount < SIM_FIFO_DEPTH) {
+    memcpy(ADXL345Sim.Fifo[ADXL345Sim.FifoCount++], XYZ, sizeof(XYZ));
+  } else {
+    ADXL345Sim.Regs[SIM_REG_INT_SOURCE] |= SIM_INT_OVERRUN;
+    // FIFO mode stops collecting, stream (and trigger) mode drops the oldest.
+    if (Mode != 0x40) {
+      memmove(ADXL345Sim.Fifo[0], ADXL345Sim.Fifo[1],
+              (SIM_FIFO_DEPTH - 1) * sizeof(ADXL345Sim.Fifo[0]));
+      memcpy(ADXL345Sim.Fifo[SIM_FIFO_DEPTH - 1], XYZ, sizeof(XYZ));
+    }
+  }
+}
+
+// Update the data registers and INT_SOURCE from the FIFO.
+static void ADXL345Sim_Publish(void) {
+  uint8_t *Regs = ADXL345Sim.Regs;
+  unsigned int Watermark = Regs[SIM_REG_FIFO_CTL] & 0x1F;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    Regs[SIM_REG_DATAX0 + 2 * i] = ADXL345Sim.Fifo[0][i] & 0xFF;
+    Regs[SIM_REG_DATAX0 + 2 * i + 1] = (uint16_t)ADXL345Sim.Fifo[0][i] >> 8;
+  }
+  Regs[SIM_REG_INT_SOURCE] &= ~(SIM_INT_DATAREADY | SIM_INT_WATERMARK);
+  if (ADXL345Sim.FifoCount)
+    Regs[SIM_REG_INT_SOURCE] |= SIM_INT_DATAREADY;
+  if ((Regs[SIM_REG_FIFO_CTL] & 0xC0) ? ADXL345Sim.FifoCount >= Watermark
+                                      : Watermark == 0)
+    Regs[SIM_REG_INT_SOURCE] |= SIM_INT_WATERMARK;
+  Regs[SIM_REG_FIFO_STATUS] =
+      (Regs[SIM_REG_FIFO_CTL] & 0xC0) ? ADXL345Sim.FifoCount : 0;
+}
+
+// Take every sample which is due by now.
+static void ADXL345Sim_Update(void) {
+  uint64_t Now = ADXL345Sim_Now();
+  uint64_t Period = ADXL345Sim_PeriodNs();
+
+  if (!ADXL345Sim_Measuring())
+    return;
+  if (!ADXL345Sim.NextSampleNs)
+    ADXL345Sim.NextSampleNs = Now + Period;
+  // After a long pause, only the last FIFO's worth of samples matters.
+  if (Now > ADXL345Sim.NextSampleNs + 2 * SIM_FIFO_DEPTH * Period)
+    ADXL345Sim.NextSampleNs = Now - SIM_FIFO_DEPTH * Period;
+  while (ADXL345Sim.NextSampleNs <= Now) {
+    ADXL345Sim_Sample(ADXL345Sim.NextSampleNs);
+    ADXL345Sim.NextSampleNs += Period;
+  }
+  ADXL345Sim_Publish();
+}
+
+// The ADXL345 side of a register read (the pointer auto-increments).
+static uint8_t ADXL345Sim_ReadReg(uint8_t Address) {
+  uint8_t Value;
+
+  ADXL345Sim_Update();
+  Value = ADXL345Sim.Regs[Address % SIM_REGS];
+  if (Address == SIM_REG_INT_SOURCE)
+    ADXL345Sim.Regs[SIM_REG_INT_SOURCE] &= ~SIM_INT_LATCHED;
+  // Reading the last data register consumes the sample.
+  if (Address == SIM_REG_DATAZ1 && ADXL345Sim.FifoCount) {
+    ADXL345Sim.FifoCount--;
+    memmove(ADXL345Sim.Fifo[0], ADXL345Sim.Fifo[1],
+            ADXL345Sim.FifoCount * sizeof(ADXL345Sim.Fifo[0]));
+    if (!ADXL345Sim.FifoCount || !(ADXL345Sim.Regs[SIM_REG_FIFO_CTL] & 0xC0))
+      ADXL345Sim.Regs[SIM_REG_INT_SOURCE] &= ~SIM_INT_OVERRUN;
+    ADXL345Sim_Publish();
+  }
+  return Value;
+}
+
+// The ADXL345 side of a register write (read only registers ignore it).
+static void ADXL345Sim_WriteReg(uint8_t Address, uint8_t Value) {
+  bool WasMeasuring = ADXL345Sim_Measuring();
+
+  ADXL345Sim_Update();
+  if (Address < SIM_REG_THRESH_TAP || Address == SIM_REG_ACT_TAP_STATUS ||
+      Address == SIM_REG_INT_SOURCE ||
+      (Address >= SIM_REG_DATAX0 && Address <= SIM_REG_DATAZ1) ||
+      Address >= SIM_REG_FIFO_STATUS)
+    return;
+  ADXL345Sim.Regs[Address] = Value;
+  // Sampling starts (one period on) as soon as MEASURE is set, whether or
+  // not anything is read in the meantime.
+  if (Address == SIM_REG_POWER_CTL && ADXL345Sim_Measuring() != WasMeasuring)
+    ADXL345Sim.NextSampleNs =
+        ADXL345Sim_Measuring() ? ADXL345Sim_Now() + ADXL345Sim_PeriodNs() : 0;
+  if (Address == SIM_REG_FIFO_CTL) {
+    // Changing the FIFO mode clears it.
+    ADXL345Sim.FifoCount = 0;
+    ADXL345Sim.Regs[SIM_REG_INT_SOURCE] &= ~SIM_INT_OVERRUN;
+  }
+  ADXL345Sim_Publish();
+}
+
+// Bytes go out on the wire, after whatever is already queued.
+static void ADXL345Sim_Wire(unsigned int Bytes) {
+  uint64_t Now = ADXL345Sim_Now();
+
+  if (ADXL345Sim.BusyUntilNs < Now)
+    ADXL345Sim.BusyUntilNs = Now;
+  ADXL345Sim.BusyUntilNs += Bytes * SIM_I2C_BYTE_NS;
+  ADXL345Sim.BusBytes += Bytes;
+}
+
+// Bytes in the RX FIFO which have been clocked in by now.
+static unsigned int ADXL345Sim_RxReady(void) {
+  uint64_t Now = ADXL345Sim_Now();
+  unsigned int Ready = 0;
+
+  while (Ready < ADXL345Sim.RxCount &&
+         ADXL345Sim.RxReadyNs[(ADXL345Sim.RxHead + Ready) %
+                              SIM_I2C_FIFO_DEPTH] <= Now)
+    Ready++;
+  return Ready;
+}
+
+// I2C0 DATA_CMD write: a (RE)START addresses the ADXL345 (and is followed
+// by the register address), then each command writes a byte, or reads one
+// into the RX FIFO.
+static void ADXL345Sim_Command(unsigned int Cmd) {
+  if (!(ADXL345Sim.Enable & 1))
+    return;
+  if (Cmd & SIM_CMD_RESTART) {
+    ADXL345Sim.Transfers++;
+    ADXL345Sim_Wire(1);
+    ADXL345Sim.Addressing = true;
+    if (ADXL345Sim.Tar != SIM_ADXL345_ADDRESS) {
+      ADXL345Sim.RawIntr |= SIM_INTR_TX_ABRT;
+      ADXL345Sim.AbrtSource = SIM_ABRT_7B_ADDR_NOACK;
+    }
+  }
+  if (ADXL345Sim.RawIntr & SIM_INTR_TX_ABRT)
+    return;
+  if (Cmd & SIM_CMD_READ) {
+    // The first read after the register address repeats the START.
+    if (ADXL345Sim.Addressing)
+      ADXL345Sim_Wire(1);
+    ADXL345Sim.Addressing = false;
+    ADXL345Sim_Wire(1);
+    if (ADXL345Sim.RxCount < SIM_I2C_FIFO_DEPTH) {
+      unsigned int Slot =
+          (ADXL345Sim.RxHead + ADXL345Sim.RxCount++) % SIM_I2C_FIFO_DEPTH;
+      ADXL345Sim.Rx[Slot] = ADXL345Sim_ReadReg(ADXL345Sim.Pointer);
+      ADXL345Sim.RxReadyNs[Slot] = ADXL345Sim.BusyUntilNs;
+    }
+    ADXL345Sim.Pointer = (ADXL345Sim.Pointer + 1) % SIM_REGS;
+  } else if (ADXL345Sim.Addressing) {
+    ADXL345Sim_Wire(1);
+    ADXL345Sim.Pointer = Cmd & 0x3F;
+    ADXL345Sim.Addressing = false;
+  } else {
+    ADXL345Sim_Wire(1);
+    ADXL345Sim_WriteReg(ADXL345Sim.Pointer, Cmd & 0xFF);
+    ADXL345Sim.Pointer = (ADXL345Sim.Pointer + 1) % SIM_REGS;
+  }
+}
+
+// Read the I2C0 register at (word) Offset.
+unsigned int ADXL345Sim_Read(unsigned int Offset) {
+  unsigned int Value = 0;
+  uint64_t Now;
+
+  if (!ADXL345Sim.Initialized)
+    ADXL345Sim_Init();
+  switch (Offset) {
+  case I2C0_DATA_CMD:
+    if (ADXL345Sim_RxReady()) {
+      Value = ADXL345Sim.Rx[ADXL345Sim.RxHead];
+      ADXL345Sim.RxHead = (ADXL345Sim.RxHead + 1) % SIM_I2C_FIFO_DEPTH;
+      ADXL345Sim.RxCount--;
+    }
+    return Value;
+  case I2C0_RXFLR:
+    return ADXL345Sim_RxReady();
+  case I2C0_TXFLR:
+    // Roughly one command per byte still to go out.
+    Now = ADXL345Sim_Now();
+    if (ADXL345Sim.BusyUntilNs <= Now)
+      return 0;
+    return (ADXL345Sim.BusyUntilNs - Now + SIM_I2C_BYTE_NS - 1) /
+           SIM_I2C_BYTE_NS;
+  case I2C0_STATUS:
+    Now = ADXL345Sim_Now();
+    if (ADXL345Sim.BusyUntilNs > Now)
+      Value |= SIM_STATUS_MST_ACTIVITY;
+    else
+      Value |= SIM_STATUS_TFE;
+    return Value | (ADXL345Sim_RxReady() ? SIM_STATUS_RFNE : 0);
+  case I2C0_RAW_INTR_STAT:
+    return ADXL345Sim.RawIntr;
+  case I2C0_CLR_TX_ABRT:
+    ADXL345Sim.RawIntr &= ~SIM_INTR_TX_ABRT;
+    ADXL345Sim.AbrtSource = 0;
+    return 0;
+  case I2C0_TX_ABRT_SOURCE:
+    return ADXL345Sim.AbrtSource;
+  case I2C0_ENABLE:
+    return ADXL345Sim.Enable;
+  case I2C0_ENABLE_STATUS:
+    return ADXL345Sim.Enable & 1;
+  case I2C0_TAR:
+    return ADXL345Sim.Tar;
+  }
+  return 0;
+}
+
+// Write Value to the I2C0 register at (word) Offset.
+void ADXL345Sim_Write(unsigned int Offset, unsigned int Value) {
+  if (!ADXL345Sim.Initialized)
+    ADXL345Sim_Init();
+  switch (Offset) {
+  case I2C0_DATA_CMD:
+    ADXL345Sim_Command(Value);
+    break;
+  case I2C0_ENABLE:
+    // Disabling (or aborting) flushes the FIFOs.
+    ADXL345Sim.Enable = Value & 1;
+    if (!ADXL345Sim.Enable) {
+      ADXL345Sim.RxCount = 0;
+      ADXL345Sim.BusyUntilNs = 0;
+    }
+    break;
+  case I2C0_TAR:
+    ADXL345Sim.Tar = Value & 0x3FF;
+    break;
+  }
+}
+
+// fileio.h replacements: there is no /dev/mem, so the register spans are
+// plain memory (only SYSMGR is actually accessed through them).
+#define __FILEIO_H__
+static inline int open_physical(int fd) { return fd == -1 ? 0 : fd; }
+static inline void close_physical(int fd) {}
+static inline void *map_physical(int fd, unsigned int base, unsigned int span) {
+  return calloc(1, span);
+}
+static inline int unmap_physical(void *virtual_base, unsigned int span) {
+  free(virtual_base);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Include DE1 Specific Address Maps
+#include "address_map_arm.h"
+#include "ADXL345.h"
+
+// Regression tests of the shared ADXL345 core (ADXL345.h) against the
+// simulator, on its virtual clock: initialization, the output data rate and
+// data format, the FIFO watermark, and events which clear when INT_SOURCE is
+// read. Prints each check, and exits with the number which failed.
+//
+// Usage: ./simtest.exe (or make test)
+
+volatile unsigned int *SYSMGRVirt;
+volatile unsigned int *I2C0Virt;
+
+int Failures;
+
+#define CHECK(Condition)                                                       \
+  do {                                                                         \
+    bool Passed = (Condition);                                                 \
+    printf("%s  %s\n", Passed ? "PASS" : "FAIL", #Condition);                 \
+    Failures += !Passed;                                                       \
+  } while (0)
+
+// When the waveform taps (ns since the simulator started), or 0 for never.
+uint64_t TapAtNs;
+
+// Lying flat and still (+1 g on Z), with a 10 ms, 5 g spike on Z at TapAtNs.
+void TestWaveform(uint64_t Ns, int MG[3]) {
+  MG[0] = 0;
+  MG[1] = 0;
+  MG[2] = 1000;
+  if (TapAtNs && Ns >= TapAtNs && Ns < TapAtNs + 10000000ULL)
+    MG[2] = 5000;
+}
+
+// Let Count output data periods (at Rate) pass.
+void WaitPeriods(uint8_t Rate, unsigned int Count) {
+  ADXL345Sim_Sleep(Count * XL345_RATE_PERIOD_US(Rate) * 1000ULL);
+}
+
+// The simulator's time since it started (ns), as the waveform sees it.
+uint64_t SimTimeNs() { return ADXL345Sim_Now() - ADXL345Sim.StartNs; }
+
+// ADXL345_Init: the device answers, and is measuring at 12.5 Hz, 10-bit
+// +/- 16 g, with the FIFO bypassed.
+void TestInit() {
+  uint8_t DevID = 0;
+  uint8_t Value = 0;
+
+  CHECK(I2C0_Init() == 0);
+  // (The simulator has set itself up by now.)
+  ADXL345Sim_SetWaveform(TestWaveform);
+  CHECK(ADXL345_IdRead(&DevID) == 0 && DevID == 0xE5);
+  CHECK(ADXL345_Init() == 0);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_BW_RATE, &Value) == 0 &&
+        Value == XL345_RATE_12_5);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_DATA_FORMAT, &Value) == 0 &&
+        Value == XL345_RANGE_16G);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_POWER_CTL, &Value) == 0 &&
+        (Value & XL345_MEASURE));
+  CHECK(ADXL345_REG_READ(ADXL345_REG_FIFO_CTL, &Value) == 0 &&
+        Value == XL345_FIFO_MODE_BYPASS);
+}
+
+// ADXL345_SetFreq and ADXL345_SetG: samples arrive at the new rate, and are
+// scaled per the new format (+1 g on Z).
+void TestRateAndFormat() {
+  int16_t XYZ[3];
+  int16_t Scale;
+  uint8_t Format;
+  uint8_t Rate;
+  uint8_t IntSource;
+  uint64_t Samples;
+
+  CHECK(ADXL345_SetFreq(100, &Rate) == 0 && Rate == XL345_RATE_100);
+  Samples = ADXL345Sim.Samples;
+  // (Under two FIFOs' worth, which the simulator would skip most of.)
+  WaitPeriods(Rate, 20);
+  CHECK(ADXL345_StatusXYZ_Read(XYZ, &IntSource) == 0 &&
+        (IntSource & XL345_DATAREADY));
+  CHECK(ADXL345Sim.Samples - Samples >= 19 &&
+        ADXL345Sim.Samples - Samples <= 21);
+  // 10-bit +/- 16 g: 31 mg/LSB.
+  CHECK(XYZ[0] == 0 && XYZ[1] == 0 && XYZ[2] >= 31 && XYZ[2] <= 33);
+
+  CHECK(ADXL345_SetG(true, 16, &Scale, &Format) == 0 && Scale == 4 &&
+        Format == (XL345_RANGE_16G | XL345_FULL_RESOLUTION));
+  WaitPeriods(Rate, 2);
+  CHECK(ADXL345_StatusXYZ_Read(XYZ, &IntSource) == 0 &&
+        (IntSource & XL345_DATAREADY));
+  // Full resolution: 3.9 mg/LSB.
+  CHECK(XYZ[2] >= 255 && XYZ[2] <= 257);
+
+  CHECK(ADXL345_SetG(false, 16, &Scale, &Format) == 0 && Scale == 31);
+}
+
+// ADXL345_SetFifo (stream mode): WATERMARK is set once Watermark samples
+// are waiting, and cleared once ADXL345_DrainFifo has read them all.
+void TestFifoWatermark() {
+  int16_t XYZ[ADXL345_DRAIN_MAX][3];
+  uint8_t Entries = 0;
+  uint8_t IntSource;
+  int Error;
+
+  CHECK(ADXL345_SetFifo(XL345_FIFO_MODE_STREAM, 16) == 0);
+  WaitPeriods(XL345_RATE_100, 15);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        !(IntSource & XL345_WATERMARK));
+  WaitPeriods(XL345_RATE_100, 2);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        (IntSource & XL345_WATERMARK));
+  CHECK(ADXL345_FifoEntries(&Entries) == 0 && Entries >= 16);
+  CHECK(ADXL345_DrainFifo(XYZ, ADXL345_DRAIN_MAX, true, &IntSource, &Error) >=
+            Entries &&
+        Error == 0 && XYZ[0][2] == 32 && XYZ[Entries - 1][2] == 32);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        !(IntSource & (XL345_WATERMARK | XL345_DATAREADY)));
+  CHECK(ADXL345_SetFifo(XL345_FIFO_MODE_BYPASS, 0) == 0);
+}
+
+// A tap sets SINGLE_TAP in INT_SOURCE, and reading INT_SOURCE clears it
+// (while DATA_READY stays, until the data is read).
+void TestClearOnRead() {
+  uint8_t IntSource;
+
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        !(IntSource & XL345_SINGLETAP));
+  TapAtNs = SimTimeNs() + 50000000ULL;
+  WaitPeriods(XL345_RATE_100, 10);
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        (IntSource & XL345_SINGLETAP) && (IntSource & XL345_DATAREADY));
+  CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &IntSource) == 0 &&
+        !(IntSource & XL345_SINGLETAP) && (IntSource & XL345_DATAREADY));
+  TapAtNs = 0;
+}
+
+int main() {
+  // Only the time spent waiting is simulated, so runs are repeatable.
+  setenv("ADXL345_SIM_CLOCK", "virtual", 0);
+  SYSMGRVirt = map_physical(0, SYSMGR_BASE, SYSMGR_SPAN);
+  I2C0Virt = map_physical(0, I2C0_BASE, I2C0_SPAN);
+  Pinmux_Config();
+
+  TestInit();
+  TestRateAndFormat();
+  TestFifoWatermark();
+  TestClearOnRead();
+
+  printf("%d check(s) failed.\n", Failures);
+  return Failures;
+}